@@ -0,0 +1,559 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      BenchTarga.cpp
+//
+//      Microbenchmarks for TargaImage operations and the libtarga reader and
+//  writers.  Every operation runs on synthetic images of several sizes, with
+//  and without alpha, and reports the median and 95th percentile time over a
+//  number of repetitions along with throughput.  Results can be saved as a
+//  JSON baseline and later runs compared against it.
+//
+//      bench_targa [-sizes 512,2048,...] [-reps N] [-warmup N] [-filter text]
+//                  [-threads N] [-json out.json] [-compare baseline.json]
+//      bench_targa -scaling [-sizes ...] [-reps N] [-warmup N] [-filter text]
+//
+//  With -compare the exit code is 1 if any operation got more than 5% slower.
+//  -scaling times every operation with 1 to 32 threads and reports parallel
+//  efficiency, the speedup over one thread divided by the thread count.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "TargaImage.h"
+#include "libtarga.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// constants
+const int       c_defaultSizes[]        = { 512, 2048, 4096, 8192 };    // square image sizes benchmarked by default
+const int       c_defaultReps           = 5;                            // timed repetitions
+const int       c_defaultWarmup         = 1;                            // untimed repetitions first
+const double    c_regressionThreshold   = 0.05;                         // slowdown flagged by -compare
+const char      c_sTempFile[]           = "bench_targa_tmp.tga";        // scratch file for file operations
+const char      c_sTempPrefix[]         = "bench_targa_mip";            // scratch prefix of the mipmap files
+const int       c_maxMipLevels          = 32;                           // more than any benchmarked image has
+const int       c_patternTile           = 16;                           // side of the Dither_Pattern threshold tile
+const int       c_scalingThreads[]      = { 1, 2, 4, 8, 16, 32 };       // thread counts compared by -scaling
+
+// one benchmarked operation, run on a fresh copy of the source image
+struct SBenchmark
+{
+    const char* sName;
+    bool (*pRun)(TargaImage& image, const TargaImage& other);
+};// SBenchmark
+
+// the timing of one operation on one image
+struct SResult
+{
+    string      sName;
+    int         size;
+    bool        bAlpha;
+    int         reps;
+    double      median;         // milliseconds
+    double      p95;            // milliseconds
+    double      throughput;     // MB of RGBA input per second at the median
+    bool        bSucceeded;     // every run reported success
+};// SResult
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The operations.  Quant_Median is declared but has no implementation,
+//  so it is not benchmarked.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool RunToRGB(TargaImage& image, const TargaImage&)
+{
+    unsigned char* rgb = image.To_RGB();
+    delete[] rgb;
+    return rgb != NULL;
+}// RunToRGB
+
+static bool RunSave(TargaImage& image, const TargaImage&)
+{
+    return image.Save_Image(c_sTempFile);
+}// RunSave
+
+static bool RunLoad(TargaImage&, const TargaImage&)
+{
+    TargaImage* pImage = TargaImage::Load_Image((char*)c_sTempFile);
+    delete pImage;
+    return pImage != NULL;
+}// RunLoad
+
+static bool RunTgaLoad(TargaImage&, const TargaImage&)
+{
+    int width, height;
+    void* pData = tga_load(c_sTempFile, &width, &height, TGA_TRUECOLOR_32);
+    free(pData);
+    return pData != NULL;
+}// RunTgaLoad
+
+static bool RunTgaWriteRaw(TargaImage& image, const TargaImage&)
+{
+    return tga_write_raw(c_sTempFile, image.width, image.height, image.data, TGA_TRUECOLOR_32) != 0;
+}// RunTgaWriteRaw
+
+static bool RunTgaWriteRle(TargaImage& image, const TargaImage&)
+{
+    return tga_write_rle(c_sTempFile, image.width, image.height, image.data, TGA_TRUECOLOR_32) != 0;
+}// RunTgaWriteRle
+
+static bool RunSaveMipmaps(TargaImage& image, const TargaImage&)
+{
+    return image.Save_Mipmaps(c_sTempPrefix);
+}// RunSaveMipmaps
+
+static bool RunGrayscale(TargaImage& image, const TargaImage&)          { return image.To_Grayscale(); }
+static bool RunQuantUniform(TargaImage& image, const TargaImage&)       { return image.Quant_Uniform(); }
+static bool RunQuantPopulosity(TargaImage& image, const TargaImage&)    { return image.Quant_Populosity(); }
+static bool RunDitherThreshold(TargaImage& image, const TargaImage&)    { return image.Dither_Threshold(); }
+static bool RunDitherRandom(TargaImage& image, const TargaImage&)       { return image.Dither_Random(); }
+static bool RunDitherFS(TargaImage& image, const TargaImage&)           { return image.Dither_FS(); }
+static bool RunDitherBright(TargaImage& image, const TargaImage&)       { return image.Dither_Bright(); }
+static bool RunDitherCluster(TargaImage& image, const TargaImage&)      { return image.Dither_Cluster(); }
+static bool RunDitherBayer(TargaImage& image, const TargaImage&)        { return image.Dither_Bayer(4); }
+static bool RunDitherColor(TargaImage& image, const TargaImage&)        { return image.Dither_Color(); }
+static bool RunCompOver(TargaImage& image, const TargaImage& other)     { TargaImage b(other); return image.Comp_Over(&b); }
+static bool RunCompIn(TargaImage& image, const TargaImage& other)       { TargaImage b(other); return image.Comp_In(&b); }
+static bool RunCompOut(TargaImage& image, const TargaImage& other)      { TargaImage b(other); return image.Comp_Out(&b); }
+static bool RunCompAtop(TargaImage& image, const TargaImage& other)     { TargaImage b(other); return image.Comp_Atop(&b); }
+static bool RunCompXor(TargaImage& image, const TargaImage& other)      { TargaImage b(other); return image.Comp_Xor(&b); }
+static bool RunDifference(TargaImage& image, const TargaImage& other)   { TargaImage b(other); return image.Difference(&b); }
+
+// a gray ramp tile scattered so neighbouring thresholds differ, as a scanned pattern would
+static TargaImage MakePatternTile()
+{
+    TargaImage tile(c_patternTile, c_patternTile);
+    for (int i = 0; i < c_patternTile * c_patternTile; i++)
+    {
+        unsigned char gray = (unsigned char)(i * 97 % 256);
+        tile.data[i * 4] = tile.data[i * 4 + 1] = tile.data[i * 4 + 2] = gray;
+        tile.data[i * 4 + 3] = 255;
+    }// for
+    return tile;
+}// MakePatternTile
+
+static bool RunDitherPattern(TargaImage& image, const TargaImage&)
+{
+    static const TargaImage tile = MakePatternTile();
+    return image.Dither_Pattern(&tile);
+}// RunDitherPattern
+
+static bool RunCompStack(TargaImage& image, const TargaImage& other)
+{
+    TargaImage layer(other);
+    TargaImage* apLayers[] = { &layer, &layer, &layer, &layer };
+    return image.Comp_Stack(TargaImage::COMPOSITE_OVER, apLayers, 4);
+}// RunCompStack
+
+static bool RunFilterBox(TargaImage& image, const TargaImage&)          { return image.Filter_Box(); }
+static bool RunFilterBoxN(TargaImage& image, const TargaImage&)         { return image.Filter_Box_N(15); }
+static bool RunFilterBartlett(TargaImage& image, const TargaImage&)     { return image.Filter_Bartlett(); }
+static bool RunFilterGaussian(TargaImage& image, const TargaImage&)     { return image.Filter_Gaussian(); }
+static bool RunFilterGaussianN(TargaImage& image, const TargaImage&)    { return image.Filter_Gaussian_N(9); }
+static bool RunFilterEdge(TargaImage& image, const TargaImage&)         { return image.Filter_Edge(); }
+static bool RunFilterEnhance(TargaImage& image, const TargaImage&)      { return image.Filter_Enhance(); }
+static bool RunNPRPaint(TargaImage& image, const TargaImage&)           { return image.NPR_Paint(); }
+static bool RunHalfSize(TargaImage& image, const TargaImage&)           { return image.Half_Size(); }
+static bool RunHalfSizeN(TargaImage& image, const TargaImage&)          { return image.Half_Size_N(3); }
+static bool RunDoubleSize(TargaImage& image, const TargaImage&)         { return image.Double_Size(); }
+static bool RunResize(TargaImage& image, const TargaImage&)             { return image.Resize(1.5f); }
+static bool RunResizeLanczos(TargaImage& image, const TargaImage&)      { return image.Resize(0.3f, TargaImage::RESIZE_LANCZOS3); }
+static bool RunRotate(TargaImage& image, const TargaImage&)             { return image.Rotate(30.0f); }
+
+// every operation benchmarked, in report order
+const SBenchmark    c_aBenchmarks[]     = { { "Save_Image",         RunSave },
+                                            { "Load_Image",         RunLoad },
+                                            { "tga_load",           RunTgaLoad },
+                                            { "tga_write_raw",      RunTgaWriteRaw },
+                                            { "tga_write_rle",      RunTgaWriteRle },
+                                            { "Save_Mipmaps",       RunSaveMipmaps },
+                                            { "To_RGB",             RunToRGB },
+                                            { "To_Grayscale",       RunGrayscale },
+                                            { "Quant_Uniform",      RunQuantUniform },
+                                            { "Quant_Populosity",   RunQuantPopulosity },
+                                            { "Dither_Threshold",   RunDitherThreshold },
+                                            { "Dither_Random",      RunDitherRandom },
+                                            { "Dither_FS",          RunDitherFS },
+                                            { "Dither_Bright",      RunDitherBright },
+                                            { "Dither_Cluster",     RunDitherCluster },
+                                            { "Dither_Bayer",       RunDitherBayer },
+                                            { "Dither_Pattern",     RunDitherPattern },
+                                            { "Dither_Color",       RunDitherColor },
+                                            { "Comp_Over",          RunCompOver },
+                                            { "Comp_In",            RunCompIn },
+                                            { "Comp_Out",           RunCompOut },
+                                            { "Comp_Atop",          RunCompAtop },
+                                            { "Comp_Xor",           RunCompXor },
+                                            { "Comp_Stack",         RunCompStack },
+                                            { "Difference",         RunDifference },
+                                            { "Filter_Box",         RunFilterBox },
+                                            { "Filter_Box_N",       RunFilterBoxN },
+                                            { "Filter_Bartlett",    RunFilterBartlett },
+                                            { "Filter_Gaussian",    RunFilterGaussian },
+                                            { "Filter_Gaussian_N",  RunFilterGaussianN },
+                                            { "Filter_Edge",        RunFilterEdge },
+                                            { "Filter_Enhance",     RunFilterEnhance },
+                                            { "NPR_Paint",          RunNPRPaint },
+                                            { "Half_Size",          RunHalfSize },
+                                            { "Half_Size_N",        RunHalfSizeN },
+                                            { "Double_Size",        RunDoubleSize },
+                                            { "Resize",             RunResize },
+                                            { "Resize_Lanczos3",    RunResizeLanczos },
+                                            { "Rotate",             RunRotate }
+                                          };
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Remove the scratch files the file operations leave behind.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void RemoveTempFiles()
+{
+    remove(c_sTempFile);
+    for (int level = 0; level < c_maxMipLevels; ++level)
+    {
+        ostringstream filename;
+        filename << c_sTempPrefix << "_" << level << ".tga";
+        remove(filename.str().c_str());
+    }// for
+}// RemoveTempFiles
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make a deterministic premultiplied test image: smooth gradients plus
+//  noise, so quantizers and run length encoding see realistic data.  Without
+//  alpha every pixel is opaque.
+//
+///////////////////////////////////////////////////////////////////////////////
+static TargaImage* MakeImage(int size, bool bAlpha, unsigned seed)
+{
+    TargaImage* pImage = new TargaImage(size, size);
+    unsigned state = seed;
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            state = state * 1664525u + 1013904223u;
+            int noise = (int)(state >> 28) - 8;
+            unsigned char* pPixel = pImage->data + ((long long)y * size + x) * 4;
+            int alpha = bAlpha ? (x * 255 / size + y * 255 / size) / 2 : 255;
+            int red = Min(Max(x * 255 / size + noise, 0), 255);
+            int green = Min(Max(y * 255 / size + noise, 0), 255);
+            int blue = Min(Max(((x + y) / 4) % 256 + noise, 0), 255);
+            pPixel[0] = (unsigned char)(red * alpha / 255);
+            pPixel[1] = (unsigned char)(green * alpha / 255);
+            pPixel[2] = (unsigned char)(blue * alpha / 255);
+            pPixel[3] = (unsigned char)alpha;
+        }// for
+    }// for
+
+    return pImage;
+}// MakeImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time one operation.  The copy of the source image is made outside the
+//  timed region.  Operations that report failure, such as the ones not yet
+//  implemented, are still timed.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Measure(const SBenchmark& benchmark, const TargaImage& source, const TargaImage& other,
+                    int warmup, int reps, SResult& result)
+{
+    vector<double> vTimes;
+    result.bSucceeded = true;
+    for (int i = 0; i < warmup + reps; ++i)
+    {
+        TargaImage image(source);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool bResult = benchmark.pRun(image, other);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        result.bSucceeded = result.bSucceeded && bResult;
+        if (i >= warmup)
+            vTimes.push_back(chrono::duration<double, milli>(end - start).count());
+    }// for
+
+    sort(vTimes.begin(), vTimes.end());
+    size_t count = vTimes.size();
+    result.sName = benchmark.sName;
+    result.size = source.width;
+    result.reps = reps;
+    result.median = count % 2 ? vTimes[count / 2] : (vTimes[count / 2 - 1] + vTimes[count / 2]) / 2;
+    result.p95 = vTimes[Min(count - 1, (size_t)(0.95 * count))];
+    double megabytes = (double)source.width * source.height * 4 / 1048576.0;
+    result.throughput = result.median > 0 ? megabytes / (result.median / 1000.0) : 0;
+}// Measure
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Key identifying an operation and input for comparisons.
+//
+///////////////////////////////////////////////////////////////////////////////
+static string ResultKey(const string& sName, int size, bool bAlpha)
+{
+    ostringstream key;
+    key << sName << ' ' << size << (bAlpha ? " alpha" : " opaque");
+    return key.str();
+}// ResultKey
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write results as JSON, one benchmark per line.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool WriteJson(const char* sFilename, const vector<SResult>& vResults)
+{
+    FILE* pFile = fopen(sFilename, "w");
+    if (!pFile)
+        return false;
+
+    fprintf(pFile, "{\"benchmarks\":[\n");
+    for (size_t i = 0; i < vResults.size(); ++i)
+    {
+        const SResult& result = vResults[i];
+        fprintf(pFile, "{\"name\":\"%s\",\"size\":%d,\"alpha\":%s,\"reps\":%d,\"median_ms\":%.6f,\"p95_ms\":%.6f,\"mb_per_s\":%.3f}%s\n",
+                result.sName.c_str(), result.size, result.bAlpha ? "true" : "false", result.reps,
+                result.median, result.p95, result.throughput, i + 1 < vResults.size() ? "," : "");
+    }// for
+    fprintf(pFile, "]}\n");
+
+    return !fclose(pFile);
+}// WriteJson
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read the median times from a file written by WriteJson.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool ReadJson(const char* sFilename, map<string, double>& medians)
+{
+    ifstream inFile(sFilename);
+    if (!inFile)
+        return false;
+
+    string sLine;
+    while (getline(inFile, sLine))
+    {
+        char sName[128];
+        char sAlpha[8];
+        int size;
+        double median;
+        if (sscanf(sLine.c_str(), "{\"name\":\"%127[^\"]\",\"size\":%d,\"alpha\":%7[a-z],\"reps\":%*d,\"median_ms\":%lf",
+                   sName, &size, sAlpha, &median) == 4)
+            medians[ResultKey(sName, size, !strcmp(sAlpha, "true"))] = median;
+    }// while
+
+    return true;
+}// ReadJson
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Time every selected operation at each thread count and print the
+//  medians and the parallel efficiency.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void RunScaling(const vector<int>& vSizes, int warmup, int reps, const char* sFilter)
+{
+    const int counts = sizeof(c_scalingThreads) / sizeof(c_scalingThreads[0]);
+
+    cout << fixed << setprecision(3);
+    cout << left << setw(20) << "operation" << right << setw(7) << "size" << setw(8) << "alpha" << setw(8) << "";
+    for (int t = 0; t < counts; ++t)
+        cout << setw(10) << c_scalingThreads[t];
+    cout << endl;
+
+    for (size_t s = 0; s < vSizes.size(); ++s)
+    {
+        for (int alpha = 0; alpha < 2; ++alpha)
+        {
+            TargaImage* pSource = MakeImage(vSizes[s], alpha != 0, 1);
+            TargaImage* pOther = MakeImage(vSizes[s], alpha != 0, 2);
+
+            for (size_t b = 0; b < sizeof(c_aBenchmarks) / sizeof(c_aBenchmarks[0]); ++b)
+            {
+                const SBenchmark& benchmark = c_aBenchmarks[b];
+                if (sFilter && !strstr(benchmark.sName, sFilter))
+                    continue;
+                if (!strncmp(benchmark.sName, "Load", 4) || !strcmp(benchmark.sName, "tga_load"))
+                    pSource->Save_Image(c_sTempFile);
+
+                vector<double> vMedians;
+                for (int t = 0; t < counts; ++t)
+                {
+                    CThreadPool::SetThreadCount(c_scalingThreads[t]);
+                    SResult result;
+                    Measure(benchmark, *pSource, *pOther, warmup, reps, result);
+                    vMedians.push_back(result.median);
+                }// for
+
+                cout << left << setw(20) << benchmark.sName << right << setw(7) << vSizes[s] << setw(8) << (alpha ? "yes" : "no")
+                     << setw(8) << "ms";
+                for (int t = 0; t < counts; ++t)
+                    cout << setw(10) << vMedians[t];
+                cout << endl << setw(43) << "eff %";
+                for (int t = 0; t < counts; ++t)
+                    cout << setw(10) << setprecision(1) << (vMedians[t] > 0 ? 100 * vMedians[0] / (vMedians[t] * c_scalingThreads[t]) : 0.0) << setprecision(3);
+                cout << endl;
+            }// for
+
+            delete pSource;
+            delete pOther;
+        }// for
+    }// for
+
+    RemoveTempFiles();
+    CThreadPool::SetThreadCount(0);
+}// RunScaling
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Main function.
+//
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    vector<int> vSizes(c_defaultSizes, c_defaultSizes + sizeof(c_defaultSizes) / sizeof(c_defaultSizes[0]));
+    int reps = c_defaultReps,
+        warmup = c_defaultWarmup;
+    const char* sFilter = NULL;
+    const char* sJsonFile = NULL;
+    const char* sCompareFile = NULL;
+    bool bScaling = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-sizes") && i + 1 < argc)
+        {
+            vSizes.clear();
+            istringstream sizes(argv[++i]);
+            string sSize;
+            while (getline(sizes, sSize, ','))
+                if (atoi(sSize.c_str()) > 0)
+                    vSizes.push_back(atoi(sSize.c_str()));
+        }// if
+        else if (!strcmp(argv[i], "-reps") && i + 1 < argc)
+            reps = Max(atoi(argv[++i]), 1);
+        else if (!strcmp(argv[i], "-warmup") && i + 1 < argc)
+            warmup = Max(atoi(argv[++i]), 0);
+        else if (!strcmp(argv[i], "-filter") && i + 1 < argc)
+            sFilter = argv[++i];
+        else if (!strcmp(argv[i], "-json") && i + 1 < argc)
+            sJsonFile = argv[++i];
+        else if (!strcmp(argv[i], "-compare") && i + 1 < argc)
+            sCompareFile = argv[++i];
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+            CThreadPool::SetThreadCount(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-scaling"))
+            bScaling = true;
+        else
+        {
+            cerr << "Usage:" << endl << "bench_targa [-sizes 512,2048,...] [-reps N] [-warmup N] [-filter text] [-threads N] [-json out.json] [-compare baseline.json]" << endl
+                 << "bench_targa -scaling [-sizes 512,2048,...] [-reps N] [-warmup N] [-filter text]" << endl;
+            return 2;
+        }// else
+    }// for
+
+    if (bScaling)
+    {
+        RunScaling(vSizes, warmup, reps, sFilter);
+        return 0;
+    }// if
+
+    map<string, double> baseline;
+    if (sCompareFile && !ReadJson(sCompareFile, baseline))
+    {
+        cerr << "Unable to read baseline:  " << sCompareFile << endl;
+        return 2;
+    }// if
+
+    // TargaImage prints through cout, keep the table readable
+    cout << fixed << setprecision(3);
+    cout << left << setw(20) << "operation" << right << setw(7) << "size" << setw(8) << "alpha"
+         << setw(12) << "median ms" << setw(12) << "p95 ms" << setw(12) << "MB/s";
+    if (sCompareFile)
+        cout << setw(10) << "change";
+    cout << endl;
+
+    vector<SResult> vResults;
+    int regressions = 0;
+    for (size_t s = 0; s < vSizes.size(); ++s)
+    {
+        for (int alpha = 0; alpha < 2; ++alpha)
+        {
+            TargaImage* pSource = MakeImage(vSizes[s], alpha != 0, 1);
+            TargaImage* pOther = MakeImage(vSizes[s], alpha != 0, 2);
+
+            for (size_t b = 0; b < sizeof(c_aBenchmarks) / sizeof(c_aBenchmarks[0]); ++b)
+            {
+                const SBenchmark& benchmark = c_aBenchmarks[b];
+                if (sFilter && !strstr(benchmark.sName, sFilter))
+                    continue;
+
+                // the loaders need a file of the right size
+                if (!strncmp(benchmark.sName, "Load", 4) || !strcmp(benchmark.sName, "tga_load"))
+                    pSource->Save_Image(c_sTempFile);
+
+                SResult result;
+                result.bAlpha = alpha != 0;
+                cout << left << setw(20) << benchmark.sName << right << setw(7) << vSizes[s] << setw(8) << (alpha ? "yes" : "no") << flush;
+                Measure(benchmark, *pSource, *pOther, warmup, reps, result);
+                cout << setw(12) << result.median << setw(12) << result.p95 << setw(12) << result.throughput;
+                map<string, double>::iterator base = baseline.find(ResultKey(result.sName, result.size, result.bAlpha));
+                if (base != baseline.end() && base->second > 0)
+                {
+                    double change = result.median / base->second - 1;
+                    cout << setw(9) << showpos << change * 100 << noshowpos << '%';
+                    if (change > c_regressionThreshold)
+                    {
+                        cout << "  REGRESSION";
+                        ++regressions;
+                    }// if
+                }// if
+                if (!result.bSucceeded)
+                    cout << "  (failed)";
+                cout << endl;
+
+                vResults.push_back(result);
+            }// for
+
+            delete pSource;
+            delete pOther;
+        }// for
+    }// for
+
+    RemoveTempFiles();
+
+    if (sJsonFile && !WriteJson(sJsonFile, vResults))
+    {
+        cerr << "Unable to write results:  " << sJsonFile << endl;
+        return 2;
+    }// if
+
+    if (sCompareFile)
+        cout << regressions << " regression(s) over " << (int)(c_regressionThreshold * 100) << "%." << endl;
+
+    return regressions ? 1 : 0;
+}// main
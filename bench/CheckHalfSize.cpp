@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CheckHalfSize.cpp
+//
+//      Checks Half_Size_N at its largest number of levels, where the filter
+//  sums are closest to overflowing: a white 16384 x 16384 image halved 14
+//  times must give one white pixel, and one level more must be refused.
+//
+//      check_half_size
+//
+//  The exit code is 1 if a check fails.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "TargaImage.h"
+#include <stdio.h>
+#include <string.h>
+
+// constants
+const unsigned  c_levels            = 14;                           // most levels Half_Size_N takes at once
+const int       c_size              = 1 << c_levels;                // smallest image that many levels apply to
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Main function.
+//
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    TargaImage image(c_size, c_size);
+    memset(image.data, 255, (size_t)c_size * c_size * 4);
+
+    bool bRefused = !image.Half_Size_N(c_levels + 1) && image.width == c_size && image.height == c_size;
+    printf("%u levels refused:  %s\n", c_levels + 1, bRefused ? "ok" : "FAILED");
+
+    bool bHalved = image.Half_Size_N(c_levels) && image.width == 1 && image.height == 1;
+    for (int c = 0; bHalved && c < 4; c++)
+        bHalved = image.data[c] == 255;
+    printf("%u levels:  %s\n", c_levels, bHalved ? "ok" : "FAILED");
+
+    return bRefused && bHalved ? 0 : 1;
+}// main
@@ -0,0 +1,198 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CheckPremultiply.cpp
+//
+//      Checks that the alpha conversion tables give the same bytes as the
+//  float arithmetic they replaced: libtarga's premultiply on loading and
+//  un-premultiply on saving, and RGBA_To_RGB for display.  Every (value,
+//  alpha) pair is converted, and the row functions are also run over
+//  random rows with opaque runs of every length and offset, so the SSE2
+//  opaque run path is compared as well as the table path.
+//
+//      check_premultiply
+//
+//  The exit code is 1 if any byte differs.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Premultiply.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+typedef unsigned char ubyte;
+
+// constants
+const int       c_randomRows        = 2000;                         // random rows run through the row functions
+const int       c_maxRowPixels      = 67;                           // longest random row
+const ubyte     c_aBackgrounds[][3] = { { 0, 0, 0 }, { 10, 200, 255 } };  // display backgrounds checked
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The arithmetic as it was.  Loading premultiplied each channel, saving
+//  divided it by alpha in tga_write_raw and tga_write_rle, and the display
+//  scaled it up in RGBA_To_RGB.
+//
+///////////////////////////////////////////////////////////////////////////////
+static ubyte Old_Premultiply(ubyte value, ubyte a)
+{
+    return (ubyte)(((float)value / 255.0f) * ((float)a / 255.0f) * 255.0f);
+}// Old_Premultiply
+
+static void Old_Unpremultiply(const ubyte* rgba, ubyte* out)
+{
+    float red, green, blue, alpha;
+    red     = rgba[0] / 255.0f;
+    green   = rgba[1] / 255.0f;
+    blue    = rgba[2] / 255.0f;
+    alpha   = rgba[3] / 255.0f;
+
+    if( alpha > 0.0001 ) {
+        red /= alpha;
+        green /= alpha;
+        blue /= alpha;
+    }
+
+    red = red > 1.0f ? 255.0f : red * 255.0f;
+    green = green > 1.0f ? 255.0f : green * 255.0f;
+    blue = blue > 1.0f ? 255.0f : blue * 255.0f;
+    alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+
+    out[0] = (ubyte)red;
+    out[1] = (ubyte)green;
+    out[2] = (ubyte)blue;
+    out[3] = (ubyte)alpha;
+}// Old_Unpremultiply
+
+static void Old_Display(const ubyte* rgba, ubyte* rgb, const ubyte* background)
+{
+    ubyte alpha = rgba[3];
+    if (alpha == 0)
+    {
+        rgb[0] = background[0];
+        rgb[1] = background[1];
+        rgb[2] = background[2];
+    }// if
+    else
+    {
+        float alpha_scale = (float)255 / (float)alpha;
+        for (int i = 0; i < 3; i++)
+        {
+            int val = (int)floor(rgba[i] * alpha_scale);
+            rgb[i] = val < 0 ? 0 : val > 255 ? 255 : (ubyte)val;
+        }// for
+    }// else
+}// Old_Display
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run both row functions over count pixels and compare them with the old
+//  arithmetic pixel by pixel, saving both into a separate buffer and in
+//  place.  Return the number of pixels that differ, reporting the first.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Check_Row(const ubyte* rgba, int count, const char* sWhat)
+{
+    vector<ubyte> vSaved(count * 4 + 1), vInPlace(rgba, rgba + count * 4), vExpected(4), vRgb(count * 3 + 1);
+    alpha_unpremultiply_row(rgba, &vSaved[0], count);
+    alpha_unpremultiply_row(&vInPlace[0], &vInPlace[0], count);
+
+    int errors = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Old_Unpremultiply(rgba + i * 4, &vExpected[0]);
+        if (memcmp(&vSaved[i * 4], &vExpected[0], 4) || memcmp(&vInPlace[i * 4], &vExpected[0], 4))
+        {
+            if (!errors++)
+                printf("%s: saving pixel %d (%d, %d, %d, %d) gives (%d, %d, %d, %d), expected (%d, %d, %d, %d)\n", sWhat, i,
+                       rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2], rgba[i * 4 + 3],
+                       vSaved[i * 4], vSaved[i * 4 + 1], vSaved[i * 4 + 2], vSaved[i * 4 + 3],
+                       vExpected[0], vExpected[1], vExpected[2], vExpected[3]);
+        }// if
+    }// for
+
+    for (size_t b = 0; b < sizeof(c_aBackgrounds) / sizeof(c_aBackgrounds[0]); b++)
+    {
+        alpha_display_row(rgba, &vRgb[0], count, c_aBackgrounds[b]);
+        for (int i = 0; i < count; i++)
+        {
+            Old_Display(rgba + i * 4, &vExpected[0], c_aBackgrounds[b]);
+            if (memcmp(&vRgb[i * 3], &vExpected[0], 3))
+            {
+                if (!errors++)
+                    printf("%s: displaying pixel %d (%d, %d, %d, %d) gives (%d, %d, %d), expected (%d, %d, %d)\n", sWhat, i,
+                           rgba[i * 4], rgba[i * 4 + 1], rgba[i * 4 + 2], rgba[i * 4 + 3],
+                           vRgb[i * 3], vRgb[i * 3 + 1], vRgb[i * 3 + 2], vExpected[0], vExpected[1], vExpected[2]);
+            }// if
+        }// for
+    }// for
+
+    return errors;
+}// Check_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Main function.
+//
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    int errors = 0;
+
+    // loading, every (value, alpha) pair of the table
+    const ubyte* pPremultiply = alpha_premultiply_table();
+    for (int a = 0; a < 256; a++)
+        for (int v = 0; v < 256; v++)
+            if (pPremultiply[a * 256 + v] != Old_Premultiply((ubyte)v, (ubyte)a) && !errors++)
+                printf("loading: value %d alpha %d gives %d, expected %d\n", v, a, pPremultiply[a * 256 + v], Old_Premultiply((ubyte)v, (ubyte)a));
+    printf("loading:  %s\n", errors ? "FAILED" : "ok");
+
+    // saving and display, every (value, alpha) pair in each channel, alpha by alpha so the opaque ones form one long run
+    vector<ubyte> vPairs(256 * 256 * 4);
+    for (int a = 0; a < 256; a++)
+        for (int v = 0; v < 256; v++)
+        {
+            ubyte* pPixel = &vPairs[(a * 256 + v) * 4];
+            pPixel[0] = (ubyte)v;
+            pPixel[1] = (ubyte)(255 - v);
+            pPixel[2] = (ubyte)(v ^ 0x5a);
+            pPixel[3] = (ubyte)a;
+        }// for
+    int pairErrors = Check_Row(&vPairs[0], 256 * 256, "all pairs");
+    printf("saving and display, all pairs:  %s\n", pairErrors ? "FAILED" : "ok");
+    errors += pairErrors;
+
+    // random rows, mostly opaque, starting at every offset from a vector boundary
+    unsigned state = 12345;
+    vector<ubyte> vRow(c_maxRowPixels * 4);
+    int rowErrors = 0;
+    for (int row = 0; row < c_randomRows; row++)
+    {
+        for (int i = 0; i < c_maxRowPixels; i++)
+        {
+            state = state * 1664525u + 1013904223u;
+            bool bOpaque = (state >> 24) < 200;
+            for (int c = 0; c < 4; c++)
+            {
+                state = state * 1664525u + 1013904223u;
+                vRow[i * 4 + c] = (ubyte)(state >> 24);
+            }// for
+            if (bOpaque)
+                vRow[i * 4 + 3] = 255;
+        }// for
+
+        int offset = row % 4;
+        int count = c_maxRowPixels - offset - row % 7;
+        rowErrors += Check_Row(&vRow[offset * 4], count, "random rows");
+    }// for
+    printf("saving and display, random rows:  %s\n", rowErrors ? "FAILED" : "ok");
+    errors += rowErrors;
+
+    return errors ? 1 : 0;
+}// main
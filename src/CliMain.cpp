@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CliMain.cpp
+//
+//      Main function of the headless front end.  Runs the scripts given on
+//  the command line, or the script server or client, without any gui.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "TargaImage.h"
+#include "ScriptHandler.h"
+#include "CommandLine.h"
+#include "ScriptServer.h"
+#include <string.h>
+#include <iostream>
+
+using namespace std;
+
+// constants
+const char      c_sHeadless[]       = "-headless";          // accepted for compatibility with the gui front end
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Main function.  Run every script file given, in order, on one image.
+//  Return 0 if they all succeeded.
+//
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+    // before any thread is started, so only the server's signal thread takes them
+    if (CCommandLine::IsServing(argc, argv))
+        CScriptServer::BlockStopSignals();
+
+    if (CCommandLine::IsServerMode(argc, argv))
+        return CCommandLine::ServeOrSend(argc, argv);
+
+    TargaImage* pImage = NULL;
+    bool bResult = true;
+
+    // nobody looks at the image the last script leaves behind
+    int lastScript = CCommandLine::LastScript(argc, argv, 1);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (CCommandLine::HandleEngineSwitch(argc, argv, i) || !strcmp(argv[i], c_sHeadless))
+            continue;
+        else if (argv[i][0] != '-')                                     // run script file
+            bResult = CScriptHandler::HandleScriptFile(argv[i], pImage, i != lastScript) && bResult;
+        else
+        {
+            CCommandLine::PrintUsage(cerr, argv[0], "scriptFilenames . . .");
+            delete pImage;
+            return 1;
+        }// else
+    }// for
+
+    delete pImage;
+    CCommandLine::Report(cout);
+    return bResult ? 0 : 1;
+}// main
@@ -0,0 +1,223 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CommandLine.cpp
+//
+//      Implementation of CCommandLine methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "CommandLine.h"
+#include "ScriptHandler.h"
+#include "ScriptServer.h"
+#include "ResultCache.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "History.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+// constants
+const char      c_sLazy[]           = "-lazy";              // lazy script evaluation command line switch
+const char      c_sNoCache[]        = "-no-cache";          // disable the result cache command line switch
+const char      c_sCacheDir[]       = "-cache-dir";         // result cache directory command line switch
+const char      c_sCacheSize[]      = "-cache-size";        // result cache size cap (MB) command line switch
+const char      c_sProfile[]        = "-profile";           // profile commands command line switch
+const char      c_sTrace[]          = "-trace";             // write a trace file command line switch
+const char      c_sThreads[]        = "-threads";           // worker thread count command line switch
+const char      c_sHistory[]        = "-history";           // undo history memory budget (MB) command line switch
+const char      c_sServe[]          = "-serve";             // run the script server command line switch
+const char      c_sClient[]         = "-client";            // send a request to the script server command line switch
+const char      c_sImage[]          = "-image";             // client request resident image command line switch
+const char      c_sCommand[]        = "-c";                 // client request script command line switch
+const char      c_sShutdown[]       = "-shutdown";          // client request server shutdown command line switch
+const char      c_sEngineUsage[]    = "[-lazy] [-no-cache] [-cache-dir directory] [-cache-size MB] [-profile] [-trace file.json] [-threads N] [-history MB]";
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Handle a switch setting up the script engine.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CCommandLine::HandleEngineSwitch(int argc, char* argv[], int& i)
+{
+    if (!strcmp(argv[i], c_sLazy))                                      // evaluate scripts lazily
+        CScriptHandler::SetLazyEvaluation(true);
+    else if (!strcmp(argv[i], c_sNoCache))                              // don't cache results
+        CResultCache::Instance().SetEnabled(false);
+    else if (!strcmp(argv[i], c_sCacheDir) && i + 1 < argc)             // cache directory
+        CResultCache::Instance().SetDirectory(argv[++i]);
+    else if (!strcmp(argv[i], c_sCacheSize) && i + 1 < argc)            // cache size cap
+        CResultCache::Instance().SetMaxBytes(strtoull(argv[++i], NULL, 10) << 20);
+    else if (!strcmp(argv[i], c_sProfile))                              // profile commands
+        CProfiler::SetEnabled(true);
+    else if (!strcmp(argv[i], c_sTrace) && i + 1 < argc)                // trace file
+        CProfiler::SetTraceFile(argv[++i]);
+    else if (!strcmp(argv[i], c_sThreads) && i + 1 < argc)              // thread pool size
+        CThreadPool::SetThreadCount(atoi(argv[++i]));
+    else if (!strcmp(argv[i], c_sHistory) && i + 1 < argc)              // undo history
+    {
+        static CHistory history(strtoull(argv[++i], NULL, 10) << 20);
+        CHistory::SetCurrent(&history);
+    }// else if
+    else
+        return false;
+
+    return true;
+}// HandleEngineSwitch
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the last script file argument, skipping switch values.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CCommandLine::LastScript(int argc, char* argv[], int first)
+{
+    int lastScript = 0;
+    for (int i = first; i < argc; ++i)
+        if (!strcmp(argv[i], c_sCacheDir) || !strcmp(argv[i], c_sCacheSize) || !strcmp(argv[i], c_sTrace) || !strcmp(argv[i], c_sThreads) || !strcmp(argv[i], c_sHistory))
+            ++i;
+        else if (argv[i][0] != '-')
+            lastScript = i;
+
+    return lastScript;
+}// LastScript
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look for the server or client switches.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CCommandLine::IsServerMode(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+        if (!strcmp(argv[i], c_sServe) || !strcmp(argv[i], c_sClient))
+            return true;
+
+    return false;
+}// IsServerMode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look for the server switch.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CCommandLine::IsServing(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+        if (!strcmp(argv[i], c_sServe))
+            return true;
+
+    return false;
+}// IsServing
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the script server, or send it a request.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CCommandLine::ServeOrSend(int argc, char* argv[])
+{
+    const char* sServePath = NULL;
+    const char* sClientPath = NULL;
+    const char* sImageName = NULL;
+    bool bShutdown = false;
+    bool bScript = false;
+    string sScript;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (HandleEngineSwitch(argc, argv, i))
+            continue;
+        else if (!strcmp(argv[i], c_sServe) && i + 1 < argc)             // server socket
+            sServePath = argv[++i];
+        else if (!strcmp(argv[i], c_sClient) && i + 1 < argc)           // server to send to
+            sClientPath = argv[++i];
+        else if (!strcmp(argv[i], c_sImage) && i + 1 < argc)            // resident image
+            sImageName = argv[++i];
+        else if (!strcmp(argv[i], c_sCommand) && i + 1 < argc)          // one command
+        {
+            sScript += argv[++i];
+            sScript += '\n';
+            bScript = true;
+        }// else if
+        else if (!strcmp(argv[i], c_sShutdown))                         // stop the server
+            bShutdown = true;
+        else if (argv[i][0] != '-')                                     // script file
+        {
+            ifstream inFile(argv[i]);
+            if (!inFile)
+            {
+                cout << "Unable to open script file:  " << argv[i] << endl;
+                return 1;
+            }// if
+
+            stringstream contents;
+            contents << inFile.rdbuf();
+            sScript += contents.str();
+            if (!sScript.empty() && sScript[sScript.size() - 1] != '\n')
+                sScript += '\n';
+            bScript = true;
+        }// else if
+        else
+        {
+            PrintUsage(cerr, argv[0], NULL);
+            return 1;
+        }// else
+    }// for
+
+    if (sServePath)
+    {
+        int result = CScriptServer::Serve(sServePath, (int)thread::hardware_concurrency());
+        Report(cout);
+        return result;
+    }// if
+
+    // nothing on the command line, read the script from standard input
+    if (!bScript && !bShutdown)
+    {
+        stringstream contents;
+        contents << cin.rdbuf();
+        sScript = contents.str();
+    }// if
+
+    return CScriptServer::Send(sClientPath, sImageName, sScript, bShutdown);
+}// ServeOrSend
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print usage.  sScriptArguments describes the arguments of the script
+//  mode of the calling front end, NULL to describe only the server modes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CCommandLine::PrintUsage(ostream& out, const char* sProgram, const char* sScriptArguments)
+{
+    out << "Usage:" << endl;
+    if (sScriptArguments)
+        out << sProgram << " " << c_sEngineUsage << " " << sScriptArguments << endl;
+    out << sProgram << " " << c_sEngineUsage << " -serve socket" << endl
+        << sProgram << " -client socket [-image name] [-c command]... [-shutdown] [scriptFilenames . . .]" << endl;
+}// PrintUsage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print the result cache statistics and the profile.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CCommandLine::Report(ostream& out)
+{
+    CResultCache::Instance().PrintStatistics(out);
+    CProfiler::Report(out);
+}// Report
@@ -0,0 +1,66 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CommandLine.h
+//
+//      Command line handling shared by the gui and the headless front end:
+//  switches that set up the script engine, the script server and client
+//  modes, and the report printed at exit.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COMMAND_LINE_H_
+#define _COMMAND_LINE_H_
+
+#include <iostream>
+
+class CCommandLine
+{
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Handle a switch setting up the script engine.  Return false if
+        //  argv[i] is not one of them, otherwise advance i past its value.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool HandleEngineSwitch(int argc, char* argv[], int& i);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Return the index of the last script file argument at or after
+        //  first, or 0 if there is none.  Nobody looks at the image that script
+        //  leaves behind.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static int LastScript(int argc, char* argv[], int first);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Return true if the arguments ask for the script server or client.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool IsServerMode(int argc, char* argv[]);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Return true if the arguments ask for the script server.  Front ends
+        //  check this before any thread is started, see
+        //  CScriptServer::BlockStopSignals.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool IsServing(int argc, char* argv[]);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Run the script server, or send it a request.  The request script is
+        //  made of the -c commands and script files given, or standard input if
+        //  there are none.  Return the process exit code.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static int ServeOrSend(int argc, char* argv[]);
+
+        static void PrintUsage(std::ostream& out, const char* sProgram, const char* sScriptArguments);
+        static void Report(std::ostream& out);      // cache statistics and profile, at exit
+};// CCommandLine
+
+#endif // _COMMAND_LINE_H_
@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CommandQueue.cpp
+//
+//      Implementation of CCommandQueue methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "CommandQueue.h"
+#include "ScriptHandler.h"
+#include "TargaImage.h"
+
+using namespace std;
+
+// constants
+const size_t    c_historyBudget         = (size_t)256 << 20;            // bytes of undo steps kept in memory
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor and destructor.  The queue starts with no image, as the
+//  script handler does.
+//
+///////////////////////////////////////////////////////////////////////////////
+CCommandQueue::CCommandQueue(ResultCallback pCallback, void* pData)
+    : m_pCallback(pCallback), m_pData(pData), m_pProgress(NULL), m_pLatest(NULL), m_history(c_historyBudget), m_bStopping(false)
+{
+    m_worker = thread(&CCommandQueue::Worker, this);
+}// CCommandQueue
+
+CCommandQueue::~CCommandQueue()
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_bStopping = true;
+        m_qsCommands.clear();
+        if (m_pProgress)
+            m_pProgress->bCancelled = true;
+    }
+    m_wake.notify_all();
+    m_worker.join();
+}// ~CCommandQueue
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue a command.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CCommandQueue::Submit(const char* sCommand)
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_qsCommands.push_back(sCommand);
+    }
+    m_wake.notify_all();
+}// Submit
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Cancel the running command and drop the queued ones.  Return the
+//  number dropped.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CCommandQueue::Cancel()
+{
+    lock_guard<mutex> lock(m_lock);
+    int dropped = (int)m_qsCommands.size();
+    m_qsCommands.clear();
+    if (m_pProgress)
+        m_pProgress->bCancelled = true;
+    return dropped;
+}// Cancel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      State of the queue.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CCommandQueue::IsBusy()
+{
+    lock_guard<mutex> lock(m_lock);
+    return m_pProgress || !m_qsCommands.empty();
+}// IsBusy
+
+double CCommandQueue::Progress()
+{
+    lock_guard<mutex> lock(m_lock);
+    if (!m_pProgress)
+        return 0.0;
+
+    long long total = m_pProgress->total;
+    return total > 0 ? Min((double)m_pProgress->done / total, 1.0) : 0.0;
+}// Progress
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Worker thread.  Run queued commands until the queue is destroyed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CCommandQueue::Worker()
+{
+    CHistory::SetCurrent(&m_history);
+    for (;;)
+    {
+        string sCommand;
+        TargaImage* pInput;
+        CThreadPool::SProgress progress;
+        {
+            unique_lock<mutex> lock(m_lock);
+            m_wake.wait(lock, [this]() { return m_bStopping || !m_qsCommands.empty(); });
+            if (m_bStopping)
+                return;
+
+            sCommand = m_qsCommands.front();
+            m_qsCommands.pop_front();
+            m_pProgress = &progress;
+            pInput = m_pLatest;
+        }
+
+        // run on a copy unless the command leaves the image alone
+        TargaImage* pImage = pInput;
+        if (pInput && !CScriptHandler::IsReadOnlyCommand(sCommand.c_str()))
+            pImage = new TargaImage(*pInput);
+
+        CHistory::SMark mark = m_history.Mark();
+        CThreadPool::SetProgress(&progress);
+        CScriptHandler::HandleCommand(sCommand.c_str(), pImage);
+        CThreadPool::SetProgress(NULL);
+
+        SResult result = { sCommand, pImage, pImage != pInput, progress.bCancelled };
+        {
+            lock_guard<mutex> lock(m_lock);
+            m_pProgress = NULL;
+            if (result.bCancelled)
+            {
+                // the history must go back with the image, a cancel may also
+                // come in after the command finished and recorded its step
+                m_history.Rollback(mark);
+                if (result.bChanged)
+                    delete pImage;
+                result.pImage = pInput;
+                result.bChanged = false;
+            }// if
+            m_pLatest = result.pImage;
+        }
+
+        m_pCallback(result, m_pData);
+    }// for
+}// Worker
@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CommandQueue.h
+//
+//      Runs script commands one after another on a worker thread so a front
+//  end stays responsive.  Each command works on a copy of the image the
+//  previous one produced; the image handed out before stays untouched and can
+//  be drawn meanwhile.  Commands that only read the image ("save") run on it
+//  directly instead of on a copy.
+//
+//  Results are passed to a callback on the worker thread, which has to hand
+//  them over to its own thread (Fl::awake for FLTK).  The receiver owns every
+//  image it is given, and must keep the latest one alive since the next
+//  command starts from it.  Progress is the share of ParallelFor rows done by
+//  the running command; cancelling it makes the pool skip its remaining
+//  chunks, throws its copy away and drops the commands queued behind it.
+//  Dropped commands are not reported back, the cancelled one is.
+//
+//  The queue keeps its own history of the commands it ran, "undo" and "redo"
+//  step through it.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COMMAND_QUEUE_H_
+#define _COMMAND_QUEUE_H_
+
+#include "ThreadPool.h"
+#include "History.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class TargaImage;
+
+class CCommandQueue
+{
+    // types
+    public:
+        struct SResult
+        {
+            std::string     sCommand;
+            TargaImage*     pImage;         // image after the command, the one it started from if cancelled
+            bool            bChanged;       // pImage is a new image
+            bool            bCancelled;
+        };// SResult
+
+        typedef void (*ResultCallback)(const SResult& result, void* pData);
+
+    // methods
+    public:
+        CCommandQueue(ResultCallback pCallback, void* pData);
+        ~CCommandQueue();                                   // cancels and waits for the worker
+
+        void Submit(const char* sCommand);                  // runs after everything submitted before
+        int Cancel();                                       // the running command and all queued ones, return how many queued were dropped
+        bool IsBusy();
+        double Progress();                                  // of the running command, 0 to 1
+
+    private:
+        void Worker();
+
+    // members
+    private:
+        ResultCallback              m_pCallback;
+        void*                       m_pData;
+        std::mutex                  m_lock;
+        std::condition_variable     m_wake;                 // commands queued or stopping
+        std::deque<std::string>     m_qsCommands;           // waiting to run
+        CThreadPool::SProgress*     m_pProgress;            // of the running command, NULL when idle
+        TargaImage*                 m_pLatest;              // the last image handed out
+        CHistory                    m_history;              // of the commands run, for "undo" and "redo"
+        bool                        m_bStopping;
+        std::thread                 m_worker;
+};// CCommandQueue
+
+#endif // _COMMAND_QUEUE_H_
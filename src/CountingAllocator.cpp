@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      CountingAllocator.cpp
+//
+//      Replaces the global operator new and delete so the profiler can count
+//  bytes allocated by commands.  Linked into the front ends only, never into
+//  the imagecore library, so programs embedding the library keep their own
+//  allocator.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Profiler.h"
+#include <stdlib.h>
+#include <new>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Counting allocator.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void* CountedAllocate(size_t size)
+{
+    CProfiler::CountAllocation(size);
+
+    void* pMemory = malloc(size ? size : 1);
+    if (!pMemory)
+        throw bad_alloc();
+    return pMemory;
+}// CountedAllocate
+
+void* operator new(size_t size)                                 { return CountedAllocate(size); }
+void* operator new[](size_t size)                               { return CountedAllocate(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept      { try { return CountedAllocate(size); } catch (...) { return NULL; } }
+void* operator new[](size_t size, const nothrow_t&) noexcept    { try { return CountedAllocate(size); } catch (...) { return NULL; } }
+void operator delete(void* pMemory) noexcept                    { free(pMemory); }
+void operator delete[](void* pMemory) noexcept                  { free(pMemory); }
+void operator delete(void* pMemory, size_t) noexcept            { free(pMemory); }
+void operator delete[](void* pMemory, size_t) noexcept          { free(pMemory); }
+void operator delete(void* pMemory, const nothrow_t&) noexcept  { free(pMemory); }
+void operator delete[](void* pMemory, const nothrow_t&) noexcept { free(pMemory); }
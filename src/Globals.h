@@ -31,6 +31,7 @@
 // global constants
 const float c_epsilon   = 0.0001f;     // small value used to compare floating point values
 const float c_pi        = 3.14159f;    // the constant pi
+const int   c_engineVersion = 8;       // bump whenever a command's output changes, this invalidates cached results
 
 #include "Globals.inl"      // global functions and templates
 
@@ -0,0 +1,598 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      History.cpp
+//
+//      Implementation of CHistory methods.
+//
+//  A delta step is the image size followed by one record per changed tile:
+//  the tile index, the size of its code and the code.  A keyframe holds the
+//  state before and the state after, each as its size, 0 x 0 for no image,
+//  the size of its records and records for the tiles that are not all zero.
+//  A code covers a tile channel by channel, row by row, as pairs of counts,
+//  zero bytes then literal bytes, each followed by its literals.  Decoding
+//  XORs the bytes into the tile, so keyframes are decoded into cleared images.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "History.h"
+#include "TargaImage.h"
+#include "ThreadPool.h"
+#include <string.h>
+
+using namespace std;
+
+// constants
+const int       c_historyTile           = 64;                           // tile size in pixels for deltas
+
+// statics
+static thread_local CHistory* s_pCurrent = NULL;
+
+// a rectangle of an RGBA image
+struct SRect
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};// SRect
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Detaches the calling thread from the progress of the command it runs
+//  while the object lives.  Coding and applying steps must not be cut short
+//  when that command is cancelled, or the tip would no longer match them.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CUncancellable
+{
+    public:
+        CUncancellable() : m_pProgress(CThreadPool::Progress())     { CThreadPool::SetProgress(NULL); }
+        ~CUncancellable()                                           { CThreadPool::SetProgress(m_pProgress); }
+
+    private:
+        CThreadPool::SProgress* m_pProgress;
+};// CUncancellable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Variable length unsigned integers, 7 bits per byte.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Put_Count(vector<unsigned char>& vOut, size_t count)
+{
+    while (count >= 0x80)
+    {
+        vOut.push_back((unsigned char)(count | 0x80));
+        count >>= 7;
+    }// while
+    vOut.push_back((unsigned char)count);
+}// Put_Count
+
+static size_t Get_Count(const unsigned char*& pIn)
+{
+    size_t count = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        unsigned char byte = *pIn++;
+        count |= (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return count;
+    }// for
+}// Get_Count
+
+static void Put_Int(vector<unsigned char>& vOut, unsigned value)
+{
+    for (int byte = 0; byte < 4; byte++)
+        vOut.push_back((unsigned char)(value >> (8 * byte)));
+}// Put_Int
+
+static unsigned Get_Int(const unsigned char*& pIn)
+{
+    unsigned value = pIn[0] | (pIn[1] << 8) | (pIn[2] << 16) | ((unsigned)pIn[3] << 24);
+    pIn += 4;
+    return value;
+}// Get_Int
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Code the XOR of a rectangle of two images of the given width, or of one
+//  image alone if pOther is NULL.  The bytes are gathered into planes first so
+//  runs are found in one contiguous buffer; a single zero between literals is
+//  kept as a literal since coding it as a run costs more.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Encode(const unsigned char* pImage, const unsigned char* pOther, int width, const SRect& rect, vector<unsigned char>& vOut)
+{
+    size_t plane = (size_t)rect.width * rect.height;
+    vector<unsigned char> vPlanes(plane * 4);
+    for (int y = 0; y < rect.height; y++)
+    {
+        size_t offset = ((size_t)(rect.y + y) * width + rect.x) * 4;
+        unsigned char* pPlanes = &vPlanes[(size_t)y * rect.width];
+        for (int x = 0; x < rect.width; x++, offset += 4)
+            for (int channel = 0; channel < 4; channel++)
+                pPlanes[channel * plane + x] = pOther ? pImage[offset + channel] ^ pOther[offset + channel] : pImage[offset + channel];
+    }// for
+
+    const unsigned char* pIn = &vPlanes[0];
+    const unsigned char* pEnd = pIn + vPlanes.size();
+    while (pIn < pEnd)
+    {
+        const unsigned char* pLiterals = pIn;
+        while (pLiterals < pEnd && !*pLiterals)
+            pLiterals++;
+        if (pLiterals == pEnd)
+            break;
+
+        const unsigned char* pZeros = pLiterals;
+        while (pZeros < pEnd && (*pZeros || (pZeros + 1 < pEnd && pZeros[1])))
+            pZeros++;
+
+        Put_Count(vOut, pLiterals - pIn);
+        Put_Count(vOut, pZeros - pLiterals);
+        vOut.insert(vOut.end(), pLiterals, pZeros);
+        pIn = pZeros;
+    }// while
+}// Encode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      XOR a code into a rectangle of an image of the given width.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Decode(const unsigned char* pIn, const unsigned char* pEnd, unsigned char* pImage, int width, const SRect& rect)
+{
+    size_t plane = (size_t)rect.width * rect.height;
+    vector<unsigned char> vPlanes(plane * 4, 0);
+    size_t position = 0;
+    while (pIn < pEnd)
+    {
+        position += Get_Count(pIn);
+        size_t literals = Get_Count(pIn);
+        memcpy(&vPlanes[position], pIn, literals);
+        pIn += literals;
+        position += literals;
+    }// while
+
+    for (int y = 0; y < rect.height; y++)
+    {
+        unsigned char* pOut = pImage + ((size_t)(rect.y + y) * width + rect.x) * 4;
+        const unsigned char* pPlanes = &vPlanes[(size_t)y * rect.width];
+        for (int x = 0; x < rect.width; x++, pOut += 4)
+            for (int channel = 0; channel < 4; channel++)
+                pOut[channel] ^= pPlanes[channel * plane + x];
+    }// for
+}// Decode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The rectangle of a tile.
+//
+///////////////////////////////////////////////////////////////////////////////
+static SRect Tile_Rect(int tile, int width, int height)
+{
+    int tilesX = (width + c_historyTile - 1) / c_historyTile;
+    SRect rect;
+    rect.x = (tile % tilesX) * c_historyTile;
+    rect.y = (tile / tilesX) * c_historyTile;
+    rect.width = Min(c_historyTile, width - rect.x);
+    rect.height = Min(c_historyTile, height - rect.y);
+    return rect;
+}// Tile_Rect
+
+static void Copy_Rect(unsigned char* pTo, const unsigned char* pFrom, int width, const SRect& rect)
+{
+    for (int y = rect.y; y < rect.y + rect.height; y++)
+    {
+        size_t offset = ((size_t)y * width + rect.x) * 4;
+        memcpy(pTo + offset, pFrom + offset, rect.width * 4);
+    }// for
+}// Copy_Rect
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append a record for every tile where pImage differs from pTip, and
+//  bring those tiles of pTip up to date.  With no tip every tile that is not
+//  all zero gets a record.  Rows of tiles are coded in parallel.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Encode_Tiles(const TargaImage* pImage, unsigned char* pTip, vector<unsigned char>& vOut)
+{
+    int width = pImage->width;
+    int height = pImage->height;
+    int tilesX = (width + c_historyTile - 1) / c_historyTile;
+    int tilesY = (height + c_historyTile - 1) / c_historyTile;
+    vector<vector<unsigned char> > vvRows(tilesY);
+    CThreadPool::ParallelFor(0, tilesY, 1, [&](int first, int last)
+    {
+        for (int ty = first; ty < last; ty++)
+            for (int tile = ty * tilesX; tile < (ty + 1) * tilesX; tile++)
+            {
+                SRect rect = Tile_Rect(tile, width, height);
+                bool bChanged = !pTip;
+                for (int y = rect.y; y < rect.y + rect.height && !bChanged; y++)
+                {
+                    size_t offset = ((size_t)y * width + rect.x) * 4;
+                    bChanged = memcmp(pImage->data + offset, pTip + offset, rect.width * 4) != 0;
+                }// for
+                if (!bChanged)
+                    continue;
+
+                vector<unsigned char> vCode;
+                Encode(pImage->data, pTip, width, rect, vCode);
+                if (vCode.empty())
+                    continue;
+
+                Put_Int(vvRows[ty], (unsigned)tile);
+                Put_Int(vvRows[ty], (unsigned)vCode.size());
+                vvRows[ty].insert(vvRows[ty].end(), vCode.begin(), vCode.end());
+                if (pTip)
+                    Copy_Rect(pTip, pImage->data, width, rect);
+            }// for
+    });
+
+    for (int ty = 0; ty < tilesY; ty++)
+        vOut.insert(vOut.end(), vvRows[ty].begin(), vvRows[ty].end());
+}// Encode_Tiles
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      XOR the tile records from pIn to pEnd into an image, in parallel, and
+//  copy the tiles touched to pCopy unless it is NULL.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Decode_Tiles(const unsigned char* pIn, const unsigned char* pEnd, unsigned char* pImage, int width, int height, unsigned char* pCopy)
+{
+    vector<const unsigned char*> vpRecords;
+    while (pIn < pEnd)
+    {
+        vpRecords.push_back(pIn);
+        Get_Int(pIn);
+        unsigned size = Get_Int(pIn);
+        pIn += size;
+    }// while
+
+    CThreadPool::ParallelFor(0, (int)vpRecords.size(), 1, [&](int first, int last)
+    {
+        for (int record = first; record < last; record++)
+        {
+            const unsigned char* pRecord = vpRecords[record];
+            SRect rect = Tile_Rect((int)Get_Int(pRecord), width, height);
+            unsigned size = Get_Int(pRecord);
+            Decode(pRecord, pRecord + size, pImage, width, rect);
+            if (pCopy)
+                Copy_Rect(pCopy, pImage, width, rect);
+        }// for
+    });
+}// Decode_Tiles
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Code a whole state of a keyframe: size, then the size of its records
+//  and the records.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Encode_State(const TargaImage* pImage, vector<unsigned char>& vOut)
+{
+    Put_Int(vOut, pImage ? pImage->width : 0);
+    Put_Int(vOut, pImage ? pImage->height : 0);
+
+    vector<unsigned char> vRecords;
+    if (pImage)
+        Encode_Tiles(pImage, NULL, vRecords);
+
+    Put_Int(vOut, (unsigned)vRecords.size());
+    vOut.insert(vOut.end(), vRecords.begin(), vRecords.end());
+}// Encode_State
+
+static TargaImage* Decode_State(const unsigned char*& pIn)
+{
+    int width = (int)Get_Int(pIn);
+    int height = (int)Get_Int(pIn);
+    unsigned size = Get_Int(pIn);
+    const unsigned char* pRecords = pIn;
+    pIn += size;
+    if (!width || !height)
+        return NULL;
+
+    TargaImage* pImage = new TargaImage(width, height);
+    memset(pImage->data, 0, (size_t)width * height * 4);
+    Decode_Tiles(pRecords, pIn, pImage->data, width, height, NULL);
+    return pImage;
+}// Decode_State
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor and destructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CHistory::CHistory(size_t memoryBudget)
+    : m_memoryBudget(memoryBudget), m_memoryBytes(0), m_bTracking(false), m_pTip(NULL), m_cursor(0), m_spilled(0), m_nextSerial(1), m_pSpillFile(NULL)
+{
+}// CHistory
+
+CHistory::~CHistory()
+{
+    delete m_pTip;
+    if (m_pSpillFile)
+        fclose(m_pSpillFile);
+}// ~CHistory
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      History of the calling thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CHistory::SetCurrent(CHistory* pHistory)
+{
+    s_pCurrent = pHistory;
+}// SetCurrent
+
+CHistory* CHistory::Current()
+{
+    return s_pCurrent;
+}// Current
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start tracking.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CHistory::Track(const TargaImage* pImage)
+{
+    if (m_bTracking)
+        return;
+
+    m_pTip = pImage && pImage->data ? new TargaImage(*pImage) : NULL;
+    m_bTracking = true;
+}// Track
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Record a step.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CHistory::Record(const TargaImage* pImage)
+{
+    if (!m_bTracking)
+    {
+        Track(pImage);
+        return;
+    }// if
+
+    if (pImage && !pImage->data)
+        pImage = NULL;
+    if (!pImage && !m_pTip)
+        return;
+
+    CUncancellable uncancellable;
+    SStep step;
+    step.bKeyframe = !pImage || !m_pTip || pImage->width != m_pTip->width || pImage->height != m_pTip->height;
+    step.offset = -1;
+    step.serial = m_nextSerial++;
+    if (step.bKeyframe)
+    {
+        Encode_State(m_pTip, step.vData);
+        Encode_State(pImage, step.vData);
+        delete m_pTip;
+        m_pTip = pImage ? new TargaImage(*pImage) : NULL;
+    }// if
+    else
+    {
+        Put_Int(step.vData, (unsigned)pImage->width);
+        Put_Int(step.vData, (unsigned)pImage->height);
+        Encode_Tiles(pImage, m_pTip->data, step.vData);
+        if (step.vData.size() == 8)
+            return;
+    }// else
+
+    // a new step drops the ones undone
+    Truncate(m_cursor);
+
+    step.size = step.vData.size();
+    m_memoryBytes += step.size;
+    m_vSteps.push_back(step);
+    m_cursor++;
+    Spill();
+}// Record
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Undo and redo.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CHistory::Undo(TargaImage*& pImage)
+{
+    if (!m_cursor || !Apply(m_vSteps[m_cursor - 1], false, pImage))
+        return false;
+
+    m_cursor--;
+    return true;
+}// Undo
+
+bool CHistory::Redo(TargaImage*& pImage)
+{
+    if (m_cursor == m_vSteps.size() || !Apply(m_vSteps[m_cursor], true, pImage))
+        return false;
+
+    m_cursor++;
+    return true;
+}// Redo
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Mark the history and roll back to a mark.  Steps are only ever dropped
+//  from the end and appended, so if the step before the marked cursor is
+//  still the one it was, every step before it is too.
+//
+///////////////////////////////////////////////////////////////////////////////
+CHistory::SMark CHistory::Mark() const
+{
+    SMark mark = { m_cursor, m_cursor ? m_vSteps[m_cursor - 1].serial : 0, m_nextSerial };
+    return mark;
+}// Mark
+
+void CHistory::Rollback(const SMark& mark)
+{
+    bool bIntact = mark.cursor <= m_vSteps.size() && (!mark.cursor || m_vSteps[mark.cursor - 1].serial == mark.before);
+
+    // Apply keeps pState equal to the tip
+    TargaImage* pState = NULL;
+    while (bIntact && m_cursor > mark.cursor)
+        bIntact = Undo(pState);
+    while (bIntact && m_cursor < mark.cursor)
+        bIntact = Redo(pState);
+    delete pState;
+
+    if (!bIntact)
+    {
+        Truncate(0);
+        m_cursor = 0;
+        delete m_pTip;
+        m_pTip = NULL;
+        m_bTracking = false;
+        return;
+    }// if
+
+    // steps undone at the mark survive unless a new step replaced them
+    size_t kept = mark.cursor;
+    while (kept < m_vSteps.size() && m_vSteps[kept].serial < mark.next)
+        kept++;
+    Truncate(kept);
+}// Rollback
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop the steps from the given one on.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CHistory::Truncate(size_t steps)
+{
+    for (size_t dropped = steps; dropped < m_vSteps.size(); dropped++)
+        if (m_vSteps[dropped].offset < 0)
+            m_memoryBytes -= m_vSteps[dropped].size;
+    m_vSteps.resize(Min(steps, m_vSteps.size()));
+    m_spilled = Min(m_spilled, steps);
+}// Truncate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take the tip across a step and leave the new state in pImage.  A delta
+//  is its own inverse; its tiles are decoded into the tip and copied to
+//  pImage, which is replaced by a copy of the tip only if it does not match
+//  it.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CHistory::Apply(SStep& step, bool bForward, TargaImage*& pImage)
+{
+    CUncancellable uncancellable;
+    vector<unsigned char> vSpilled;
+    if (step.offset >= 0 && !Read(step, vSpilled))
+        return false;
+
+    const vector<unsigned char>& vData = step.offset >= 0 ? vSpilled : step.vData;
+    const unsigned char* pIn = &vData[0];
+    if (step.bKeyframe)
+    {
+        TargaImage* pBefore = Decode_State(pIn);
+        TargaImage* pAfter = Decode_State(pIn);
+        delete m_pTip;
+        m_pTip = bForward ? pAfter : pBefore;
+        delete (bForward ? pBefore : pAfter);
+
+        delete pImage;
+        pImage = m_pTip ? new TargaImage(*m_pTip) : NULL;
+        return true;
+    }// if
+
+    int width = (int)Get_Int(pIn);
+    int height = (int)Get_Int(pIn);
+    if (!m_pTip || m_pTip->width != width || m_pTip->height != height)
+        return false;
+
+    bool bInStep = pImage && pImage->data && pImage->width == width && pImage->height == height;
+    Decode_Tiles(pIn, &vData[0] + vData.size(), m_pTip->data, width, height, bInStep ? pImage->data : NULL);
+
+    if (!bInStep)
+    {
+        delete pImage;
+        pImage = new TargaImage(*m_pTip);
+    }// if
+
+    return true;
+}// Apply
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the oldest steps still in memory to the spill file until the
+//  rest fit the budget.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CHistory::Spill()
+{
+    while (m_memoryBytes > m_memoryBudget && m_spilled < m_vSteps.size())
+    {
+        SStep& step = m_vSteps[m_spilled];
+        if (step.offset < 0)
+        {
+            if (!m_pSpillFile && !(m_pSpillFile = tmpfile()))
+                return;
+
+            fseek(m_pSpillFile, 0, SEEK_END);
+            long offset = ftell(m_pSpillFile);
+            if (offset < 0 || fwrite(&step.vData[0], 1, step.size, m_pSpillFile) != step.size)
+                return;
+
+            step.offset = offset;
+            vector<unsigned char>().swap(step.vData);
+            m_memoryBytes -= step.size;
+        }// if
+        m_spilled++;
+    }// while
+}// Spill
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read a spilled step.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CHistory::Read(const SStep& step, vector<unsigned char>& vData)
+{
+    vData.resize(step.size);
+    return !fseek(m_pSpillFile, step.offset, SEEK_SET) && fread(&vData[0], 1, step.size, m_pSpillFile) == step.size;
+}// Read
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Memory budget and bytes of the steps in memory.
+//
+///////////////////////////////////////////////////////////////////////////////
+size_t CHistory::MemoryBudget() const
+{
+    return m_memoryBudget;
+}// MemoryBudget
+
+size_t CHistory::MemoryBytes() const
+{
+    return m_memoryBytes;
+}// MemoryBytes
@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      History.h
+//
+//      Undo and redo history of an image.  The history keeps one copy of the
+//  current state, the tip, and every step as the difference to the state
+//  before it: the image is cut in c_historyTile tiles, unchanged tiles are
+//  skipped and changed ones stored as the XOR of both states, channel by
+//  channel and run length coded, so untouched channels and pixels cost next
+//  to nothing.  The same delta takes the tip either way, so undoing a step
+//  only touches the tiles it changed.  Steps that change the image size are
+//  keyframes holding both states whole, run length coded.
+//
+//  Steps are kept in memory up to a budget; past it the oldest are written
+//  to a temporary file and read back when they are undone or redone.
+//
+//  The script handler records every command that changes the image into the
+//  history current on the calling thread, if any, and runs "undo" and "redo"
+//  against it.  While a history is current all changes to the image must go
+//  through the script handler.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+class TargaImage;
+
+class CHistory
+{
+    // types
+    public:
+        // the history as it was, for Rollback
+        struct SMark
+        {
+            size_t              cursor;
+            unsigned long long  before;             // serial of the step before the cursor, 0 for none
+            unsigned long long  next;               // serial of the next step to be recorded
+        };// SMark
+
+    // methods
+    public:
+        CHistory(size_t memoryBudget);              // bytes of steps kept in memory
+        ~CHistory();
+
+        static void SetCurrent(CHistory* pHistory); // for the calling thread, NULL for none
+        static CHistory* Current();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Start from the given state, if the history has none yet.  pImage
+        //  may be NULL for no image.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Track(const TargaImage* pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Record the change from the tip to the given state as a step, unless
+        //  there is none.  Steps undone before are dropped.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Record(const TargaImage* pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Step back or forward, leaving the state in pImage, which must hold
+        //  the tip.  pImage may be replaced, or become NULL when going back before
+        //  the first image was loaded.  Return false if there is no such step.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        bool Undo(TargaImage*& pImage);
+        bool Redo(TargaImage*& pImage);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Rollback takes the tip back to the state at Mark and drops the steps
+        //  recorded since, for commands that were cancelled and whose image is
+        //  thrown away; the caller goes back to the image it had at Mark.  Steps
+        //  undone and then replaced since the mark are gone, and if the marked
+        //  state went with them the history starts over from the next command.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        SMark Mark() const;
+        void Rollback(const SMark& mark);
+
+        size_t MemoryBudget() const;
+        size_t MemoryBytes() const;                 // steps held in memory
+
+    private:
+        struct SStep
+        {
+            bool                        bKeyframe;
+            std::vector<unsigned char>  vData;      // the coded step, empty while spilled
+            size_t                      size;       // bytes of the coded step
+            long                        offset;     // in the spill file, -1 if in memory
+            unsigned long long          serial;     // order in which steps were recorded, from 1
+        };// SStep
+
+        bool Apply(SStep& step, bool bForward, TargaImage*& pImage);
+        void Truncate(size_t steps);                // drop the steps from this one on
+        void Spill();                               // move old steps to disk until within budget
+        bool Read(const SStep& step, std::vector<unsigned char>& vData);    // a spilled step
+
+    // members
+    private:
+        size_t                  m_memoryBudget;
+        size_t                  m_memoryBytes;
+        bool                    m_bTracking;        // m_pTip holds the current state
+        TargaImage*             m_pTip;             // current state, NULL for no image
+        std::vector<SStep>      m_vSteps;
+        size_t                  m_cursor;           // steps before it are done, the rest undone
+        size_t                  m_spilled;          // steps before it have been spilled
+        unsigned long long      m_nextSerial;
+        FILE*                   m_pSpillFile;       // temporary, removed when closed
+};// CHistory
+
+#endif // _HISTORY_H_
@@ -0,0 +1,333 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageStats.cpp
+//
+//      Implementation of CImageStats methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ImageStats.h"
+#include "TargaImage.h"
+#include "ThreadPool.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+// constants
+const int       c_statsGrainPixels      = 1 << 18;                      // pixels per chunk, each also reads c_ssimWindow - 1 rows below it
+const int       c_ssimWindow            = 7;                            // SSIM window size in pixels
+const double    c_ssimC1                = (0.01 * 255) * (0.01 * 255);  // stabilizers of the SSIM formula
+const double    c_ssimC2                = (0.03 * 255) * (0.03 * 255);
+const char      c_asChannels[][8]       = { "r", "g", "b", "a" };
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Luma of a pixel, Rec. 601 weights in 8 bit fixed point.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline int Luma(const unsigned char* pPixel)
+{
+    return (77 * pPixel[0] + 150 * pPixel[1] + 29 * pPixel[2] + 128) >> 8;
+}// Luma
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructors.
+//
+///////////////////////////////////////////////////////////////////////////////
+CImageStats::CImageStats(const TargaImage& image)
+    : m_width(image.width), m_height(image.height), m_bCompared(false)
+{
+    Measure(image, NULL);
+}// CImageStats
+
+CImageStats::CImageStats(const TargaImage& image, const TargaImage& other)
+    : m_width(image.width), m_height(image.height), m_bCompared(true)
+{
+    Measure(image, &other);
+}// CImageStats
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Measure chunks of rows in parallel and combine them in order.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageStats::Measure(const TargaImage& image, const TargaImage* pOther)
+{
+    SMeasures identity;
+    memset(&identity, 0, sizeof(identity));
+    for (int channel = 0; channel < 4; channel++)
+        identity.aMaxErrorAt[channel] = -1;
+
+    m_measures = CThreadPool::ParallelReduce(0, image.data ? m_height : 0, Max(c_statsGrainPixels / Max(m_width, 1), 1), identity,
+        [&](int first, int last)
+        {
+            SMeasures measures = identity;
+            Measure_Rows(image, pOther, first, last, measures);
+            return measures;
+        },
+        [](SMeasures result, const SMeasures& measures)
+        {
+            Combine(result, measures);
+            return result;
+        });
+}// Measure
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Measure rows [first, last), and the SSIM windows whose top row is
+//  among them.  The luma of the rows the windows cover is computed once, then
+//  column sums over c_ssimWindow rows slide down and window sums slide across
+//  them, so a window costs a few additions whatever its size.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageStats::Measure_Rows(const TargaImage& image, const TargaImage* pOther, int first, int last, SMeasures& measures)
+{
+    int width = image.width;
+    for (int y = first; y < last; y++)
+    {
+        const unsigned char* pPixel = image.data + (size_t)y * width * 4;
+        const unsigned char* pOtherPixel = pOther ? pOther->data + (size_t)y * width * 4 : NULL;
+        for (int x = 0; x < width; x++, pPixel += 4)
+            for (int channel = 0; channel < 4; channel++)
+            {
+                measures.aaHistogram[0][channel][pPixel[channel]]++;
+                if (!pOtherPixel)
+                    continue;
+
+                int value = *pOtherPixel++;
+                measures.aaHistogram[1][channel][value]++;
+                int error = abs(pPixel[channel] - value);
+                measures.aSquaredError[channel] += error * error;
+                if (error > measures.aMaxError[channel])
+                {
+                    measures.aMaxError[channel] = error;
+                    measures.aMaxErrorAt[channel] = (long long)y * width + x;
+                }// if
+            }// for
+    }// for
+
+    int windowsLast = Min(last, image.height - c_ssimWindow + 1);
+    int windowsX = width - c_ssimWindow + 1;
+    if (!pOther || first >= windowsLast || windowsX <= 0)
+        return;
+
+    // luma of the rows covered
+    int rows = windowsLast - first + c_ssimWindow - 1;
+    vector<int> vLuma((size_t)rows * width), vOtherLuma((size_t)rows * width);
+    for (int row = 0; row < rows; row++)
+        for (int x = 0; x < width; x++)
+        {
+            size_t offset = ((size_t)(first + row) * width + x) * 4;
+            vLuma[(size_t)row * width + x] = Luma(image.data + offset);
+            vOtherLuma[(size_t)row * width + x] = Luma(pOther->data + offset);
+        }// for
+
+    // column sums of a, b, a^2, b^2 and ab over the window's rows
+    vector<int> vColumns((size_t)width * 5, 0);
+    for (int row = 0; row < c_ssimWindow - 1; row++)
+        for (int x = 0; x < width; x++)
+        {
+            int a = vLuma[(size_t)row * width + x], b = vOtherLuma[(size_t)row * width + x];
+            int* pColumn = &vColumns[(size_t)x * 5];
+            pColumn[0] += a;
+            pColumn[1] += b;
+            pColumn[2] += a * a;
+            pColumn[3] += b * b;
+            pColumn[4] += a * b;
+        }// for
+
+    const double area = c_ssimWindow * c_ssimWindow;
+    for (int y = first; y < windowsLast; y++)
+    {
+        // add the window's bottom row
+        int bottom = y - first + c_ssimWindow - 1;
+        for (int x = 0; x < width; x++)
+        {
+            int a = vLuma[(size_t)bottom * width + x], b = vOtherLuma[(size_t)bottom * width + x];
+            int* pColumn = &vColumns[(size_t)x * 5];
+            pColumn[0] += a;
+            pColumn[1] += b;
+            pColumn[2] += a * a;
+            pColumn[3] += b * b;
+            pColumn[4] += a * b;
+        }// for
+
+        int aSums[5] = { 0, 0, 0, 0, 0 };
+        for (int x = 0; x < width; x++)
+        {
+            for (int sum = 0; sum < 5; sum++)
+                aSums[sum] += vColumns[(size_t)x * 5 + sum];
+            if (x >= c_ssimWindow)
+                for (int sum = 0; sum < 5; sum++)
+                    aSums[sum] -= vColumns[(size_t)(x - c_ssimWindow) * 5 + sum];
+            if (x < c_ssimWindow - 1)
+                continue;
+
+            double meanA = aSums[0] / area, meanB = aSums[1] / area;
+            double varianceA = aSums[2] / area - meanA * meanA;
+            double varianceB = aSums[3] / area - meanB * meanB;
+            double covariance = aSums[4] / area - meanA * meanB;
+            measures.ssimSum += ((2 * meanA * meanB + c_ssimC1) * (2 * covariance + c_ssimC2))
+                              / ((meanA * meanA + meanB * meanB + c_ssimC1) * (varianceA + varianceB + c_ssimC2));
+        }// for
+        measures.ssimWindows += windowsX;
+
+        // drop the window's top row
+        int top = y - first;
+        for (int x = 0; x < width; x++)
+        {
+            int a = vLuma[(size_t)top * width + x], b = vOtherLuma[(size_t)top * width + x];
+            int* pColumn = &vColumns[(size_t)x * 5];
+            pColumn[0] -= a;
+            pColumn[1] -= b;
+            pColumn[2] -= a * a;
+            pColumn[3] -= b * b;
+            pColumn[4] -= a * b;
+        }// for
+    }// for
+}// Measure_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add the measures of a later chunk.  Ties of the largest error keep the
+//  earlier pixel.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageStats::Combine(SMeasures& into, const SMeasures& measures)
+{
+    for (int image = 0; image < 2; image++)
+        for (int channel = 0; channel < 4; channel++)
+            for (int value = 0; value < 256; value++)
+                into.aaHistogram[image][channel][value] += measures.aaHistogram[image][channel][value];
+
+    for (int channel = 0; channel < 4; channel++)
+    {
+        into.aSquaredError[channel] += measures.aSquaredError[channel];
+        if (measures.aMaxError[channel] > into.aMaxError[channel])
+        {
+            into.aMaxError[channel] = measures.aMaxError[channel];
+            into.aMaxErrorAt[channel] = measures.aMaxErrorAt[channel];
+        }// if
+    }// for
+
+    into.ssimSum += measures.ssimSum;
+    into.ssimWindows += measures.ssimWindows;
+}// Combine
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the statistics of the image (index 0) or the other (1).
+//
+///////////////////////////////////////////////////////////////////////////////
+void CImageStats::Write_Image(FILE* pFile, int index) const
+{
+    fprintf(pFile, "{");
+    for (int channel = 0; channel < 4; channel++)
+    {
+        const unsigned long long* pHistogram = m_measures.aaHistogram[index][channel];
+        unsigned long long count = 0, sum = 0, squares = 0;
+        int minimum = -1, maximum = -1;
+        for (int value = 0; value < 256; value++)
+            if (pHistogram[value])
+            {
+                minimum = minimum < 0 ? value : minimum;
+                maximum = value;
+                count += pHistogram[value];
+                sum += pHistogram[value] * value;
+                squares += pHistogram[value] * value * value;
+            }// if
+
+        double mean = count ? (double)sum / count : 0.0;
+        double deviation = count ? sqrt(Max((double)squares / count - mean * mean, 0.0)) : 0.0;
+        fprintf(pFile, "%s\n    \"%s\":{\"min\":%d,\"max\":%d,\"mean\":%.6f,\"stddev\":%.6f,\"histogram\":[",
+                channel ? "," : "", c_asChannels[channel], Max(minimum, 0), Max(maximum, 0), mean, deviation);
+        for (int value = 0; value < 256; value++)
+            fprintf(pFile, "%s%llu", value ? "," : "", pHistogram[value]);
+        fprintf(pFile, "]}");
+    }// for
+    fprintf(pFile, "}");
+}// Write_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the results.  PSNR is null where the images match, as is the
+//  position of the largest error, and SSIM when the images are smaller than
+//  a window.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CImageStats::Write(const char* sFilename) const
+{
+    FILE* pFile = sFilename ? fopen(sFilename, "w") : stdout;
+    if (!pFile)
+        return false;
+
+    fprintf(pFile, "{\"width\":%d,\"height\":%d,\n\"image\":", m_width, m_height);
+    Write_Image(pFile, 0);
+    if (m_bCompared)
+    {
+        fprintf(pFile, ",\n\"other\":");
+        Write_Image(pFile, 1);
+
+        double samples = (double)m_width * m_height;
+        unsigned long long squaredError = 0;
+        int maxError = 0;
+        long long maxErrorAt = -1;
+        fprintf(pFile, ",\n\"difference\":{");
+        for (int channel = 0; channel < 4; channel++)
+        {
+            double mse = samples > 0 ? m_measures.aSquaredError[channel] / samples : 0.0;
+            long long at = m_measures.aMaxErrorAt[channel];
+            fprintf(pFile, "%s\n    \"%s\":{\"mse\":%.6f,\"psnr\":", channel ? "," : "", c_asChannels[channel], mse);
+            if (mse > 0)
+                fprintf(pFile, "%.4f", 10 * log10(255.0 * 255.0 / mse));
+            else
+                fprintf(pFile, "null");
+            fprintf(pFile, ",\"max_abs_error\":%d,\"at\":", m_measures.aMaxError[channel]);
+            if (at >= 0)
+                fprintf(pFile, "[%lld,%lld]}", at % m_width, at / m_width);
+            else
+                fprintf(pFile, "null}");
+
+            squaredError += m_measures.aSquaredError[channel];
+            if (m_measures.aMaxError[channel] > maxError || (m_measures.aMaxError[channel] == maxError && at >= 0 && at < maxErrorAt))
+            {
+                maxError = m_measures.aMaxError[channel];
+                maxErrorAt = at;
+            }// if
+        }// for
+
+        double mse = samples > 0 ? squaredError / (samples * 4) : 0.0;
+        fprintf(pFile, ",\n    \"mse\":%.6f,\"psnr\":", mse);
+        if (mse > 0)
+            fprintf(pFile, "%.4f", 10 * log10(255.0 * 255.0 / mse));
+        else
+            fprintf(pFile, "null");
+        fprintf(pFile, ",\"max_abs_error\":%d,\"at\":", maxError);
+        if (maxErrorAt >= 0)
+            fprintf(pFile, "[%lld,%lld]", maxErrorAt % m_width, maxErrorAt / m_width);
+        else
+            fprintf(pFile, "null");
+        fprintf(pFile, ",\"ssim\":");
+        if (m_measures.ssimWindows)
+            fprintf(pFile, "%.6f}", m_measures.ssimSum / m_measures.ssimWindows);
+        else
+            fprintf(pFile, "null}");
+    }// if
+    fprintf(pFile, "}\n");
+
+    if (pFile == stdout)
+        return !fflush(pFile);
+    return !fclose(pFile);
+}// Write
@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageStats.h
+//
+//      Statistics of an image, and quality metrics against another of the same
+//  size, for regression checks.  Everything is measured in one parallel pass
+//  over the rows: per channel histograms, from which min, max, mean and
+//  standard deviation follow, squared and largest absolute errors, and SSIM
+//  of the luma over c_ssimWindow square windows from sliding box sums.  The
+//  values are the stored, premultiplied ones, so transparent pixels count as
+//  black.  Chunks don't depend on the thread count, so results are the same
+//  for any number of threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _IMAGE_STATS_H_
+#define _IMAGE_STATS_H_
+
+#include <stdio.h>
+
+class TargaImage;
+
+class CImageStats
+{
+    // methods
+    public:
+        CImageStats(const TargaImage& image);                               // statistics of one image
+        CImageStats(const TargaImage& image, const TargaImage& other);      // of both and how they differ, sizes must match
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Write the results as JSON to the named file, or to standard output
+        //  if sFilename is NULL.  Return false if the file can't be written.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        bool Write(const char* sFilename) const;
+
+    private:
+        struct SMeasures
+        {
+            unsigned long long  aaHistogram[2][4][256]; // of the image and the other, per channel
+            unsigned long long  aSquaredError[4];
+            int                 aMaxError[4];           // largest absolute error per channel
+            long long           aMaxErrorAt[4];         // first pixel with it, -1 if the images match
+            double              ssimSum;                // over the windows
+            long long           ssimWindows;
+        };// SMeasures
+
+        void Measure(const TargaImage& image, const TargaImage* pOther);
+        static void Measure_Rows(const TargaImage& image, const TargaImage* pOther, int first, int last, SMeasures& measures);
+        static void Combine(SMeasures& into, const SMeasures& measures);
+        void Write_Image(FILE* pFile, int index) const;
+
+    // members
+    private:
+        int                     m_width;
+        int                     m_height;
+        bool                    m_bCompared;
+        SMeasures               m_measures;
+};// CImageStats
+
+#endif // _IMAGE_STATS_H_
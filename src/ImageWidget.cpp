@@ -11,10 +11,13 @@
 
 #include "Globals.h"
 #include "ImageWidget.h"
-#include <Fl/Fl_Window.h>
-#include <Fl/Fl_Input.h>
-#include <Fl/Fl_Box.h>
-#include <Fl/fl_draw.h>
+#include <FL/Fl_Window.H>
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Input.H>
+#include <FL/Fl_Box.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Progress.H>
+#include <FL/fl_draw.H>
 #include "libtarga.h"
 #include <string.h>
 #include "TargaImage.h"
@@ -25,9 +28,14 @@ const int   c_border                = 10;
 const int   c_buttonHeight          = 30;                                       // button height in pixels
 const int   c_commandInputBoxWidth  = 200;                                      // input box width
 const int   c_commandTextWidth      = 120;                                      // static text width
+const int   c_progressWidth         = 120;                                      // progress bar width
+const int   c_cancelButtonWidth     = 70;                                       // cancel button width
+const int   c_controlWidth          = c_commandTextWidth + c_commandInputBoxWidth + c_progressWidth + c_cancelButtonWidth + 2 * c_border;   // width of all controls
 const int   c_buttonPaneHeight      = 2 * c_border + c_buttonHeight;            // height of pane for buttons in pixels
-const int   c_minWindowWidth        = 350;                                      // minimum window width in pixels
+const int   c_minWindowWidth        = c_controlWidth + 2 * c_border;            // minimum window width in pixels
 const int   c_minWindowHeight       = 100;                                      // minimum windoe height in pixels
+const double c_progressInterval     = 0.1;                                      // seconds between progress bar updates
+const int   c_proxySize             = 256;                                      // largest proxy width or height in pixels
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -35,20 +43,42 @@ const int   c_minWindowHeight       = 100;
 //      Constructor.  Add the buttons to the window.
 //
 ///////////////////////////////////////////////////////////////////////////////
-ImageWidget::ImageWidget(int x, int y, int w, int h, const char *title) : Fl_Widget(x, y, Max(w, c_minWindowWidth), Max(h, c_minWindowHeight), title), m_pImage(NULL)
+ImageWidget::ImageWidget(int x, int y, int w, int h, const char *title) : Fl_Widget(x, y, Max(w, c_minWindowWidth), Max(h, c_minWindowHeight), title), m_pImage(NULL), m_pDisplay(NULL),
+    m_displayWidth(0), m_displayHeight(0), m_bDisplayValid(false), m_fittedWidth(0), m_fittedHeight(0), m_dragX(0), m_dragY(0),
+    m_pProxy(NULL), m_proxyLevels(0), m_pendingResults(0)
 {
-    // add controls-
+    // add controls- in a pane that keeps them as they are when the window resizes
     int horizontalCenter = Max(w, c_minWindowWidth) / 2;
-    int halfControlWidth = (c_commandInputBoxWidth + c_commandTextWidth + c_border) / 2;
+    int controlX = horizontalCenter - c_controlWidth / 2;
     int verticalButtonPos = c_border;
+    Fl_Group* pPane = new Fl_Group(x, y, Max(w, c_minWindowWidth), c_buttonPaneHeight);
 
     // add label
-    m_pStaticTextBox = new Fl_Box(horizontalCenter - halfControlWidth, verticalButtonPos, c_commandTextWidth, c_buttonHeight, "Enter Command:");
+    m_pStaticTextBox = new Fl_Box(controlX, verticalButtonPos, c_commandTextWidth, c_buttonHeight, "Enter Command:");
+    controlX += c_commandTextWidth;
 
     // add input box
-    m_pCommandInput = new Fl_Input(horizontalCenter - halfControlWidth + c_commandTextWidth, verticalButtonPos, c_commandInputBoxWidth, c_buttonHeight, "");
+    m_pCommandInput = new Fl_Input(controlX, verticalButtonPos, c_commandInputBoxWidth, c_buttonHeight, "");
     m_pCommandInput->callback(CommandCallback, this);
     m_pCommandInput->when(FL_WHEN_ENTER_KEY|FL_WHEN_NOT_CHANGED);
+    controlX += c_commandInputBoxWidth + c_border;
+
+    // add progress bar and cancel button, shown while commands run
+    m_pProgress = new Fl_Progress(controlX, verticalButtonPos, c_progressWidth, c_buttonHeight);
+    m_pProgress->minimum(0);
+    m_pProgress->maximum(100);
+    m_pProgress->hide();
+    controlX += c_progressWidth + c_border;
+
+    m_pCancelButton = new Fl_Button(controlX, verticalButtonPos, c_cancelButtonWidth, c_buttonHeight, "Cancel");
+    m_pCancelButton->callback(CancelCallback, this);
+    m_pCancelButton->hide();
+    pPane->resizable(NULL);
+    pPane->end();
+
+    // the image is shown below the pane
+    resize(x, y + c_buttonPaneHeight, Max(w, c_minWindowWidth), Max(h, c_minWindowHeight) - c_buttonPaneHeight);
+    m_pQueue = new CCommandQueue(QueueCallback, this);
 }// ImageWidget
 
 
@@ -59,6 +89,10 @@ ImageWidget::ImageWidget(int x, int y, int w, int h, const char *title) : Fl_Wid
 ///////////////////////////////////////////////////////////////////////////////
 ImageWidget::~ImageWidget()
 {
+    Fl::remove_timeout(ProgressCallback, this);
+    delete m_pQueue;
+    delete[] m_pDisplay;
+    delete m_pProxy;
     delete m_pImage;
 }// ~ImageWidget
 
@@ -76,33 +110,196 @@ TargaImage* ImageWidget::Get_Image()
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Draw the window contents.
+//      Draw the window contents.  Only the widget's pixels are converted, so
+//  drawing costs the same for any image size.
 //
 ///////////////////////////////////////////////////////////////////////////////
 void ImageWidget::draw()
 {
-    if (!m_pImage)          // Don't do anything if the image is empty.
-    	return;
-    
-    unsigned char   *rgb;
-    rgb = m_pImage->To_RGB(); // Convert the pre-multiplied RGBA image into RGB.
-    unsigned int imageX = x() + (w() > m_pImage->width) ? (w() - m_pImage->width) / 2 : 0;
-    fl_draw_image(rgb, imageX, y() + c_border * 2 + c_buttonHeight, m_pImage->width, m_pImage->height, 3);
-    delete[] rgb;
+    if (!m_pDisplay || m_displayWidth != w() || m_displayHeight != h())
+    {
+        delete[] m_pDisplay;
+        m_displayWidth = w();
+        m_displayHeight = h();
+        m_pDisplay = new unsigned char[m_displayWidth * m_displayHeight * 3];
+        m_bDisplayValid = false;
+    }// if
+
+    if (!m_bDisplayValid)
+        m_viewport.Render(m_pDisplay, m_displayWidth, m_displayHeight);
+    m_bDisplayValid = true;
+    fl_draw_image(m_pDisplay, x(), y(), m_displayWidth, m_displayHeight, 3);
 }// draw
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Redraw the window.
+//      Mouse handling.  The wheel zooms around the pointer, dragging scrolls
+//  and a double click fits the image in the widget.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ImageWidget::handle(int event)
+{
+    switch (event)
+    {
+        case FL_MOUSEWHEEL:
+            if (m_viewport.Zoom(-Fl::event_dy(), Fl::event_x() - x(), Fl::event_y() - y()))
+            {
+                m_bDisplayValid = false;
+                redraw();
+            }// if
+            return 1;
+
+        case FL_PUSH:
+            m_dragX = Fl::event_x();
+            m_dragY = Fl::event_y();
+            if (Fl::event_clicks())
+            {
+                m_viewport.Fit(w(), h());
+                m_bDisplayValid = false;
+                redraw();
+            }// if
+            return 1;
+
+        case FL_DRAG:
+            m_viewport.Scroll(Fl::event_x() - m_dragX, Fl::event_y() - m_dragY);
+            m_dragX = Fl::event_x();
+            m_dragY = Fl::event_y();
+            m_bDisplayValid = false;
+            redraw();
+            return 1;
+
+        case FL_RELEASE:
+            return 1;
+
+        default:
+            return Fl_Widget::handle(event);
+    }// switch
+}// handle
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The image on screen: the preview while entered commands haven't all
+//  finished, else the current image.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* ImageWidget::Displayed_Image()
+{
+    return m_pendingResults > 0 && m_pProxy ? m_pProxy : m_pImage;
+}// Displayed_Image
+
+void ImageWidget::Displayed_Size(int& width, int& height)
+{
+    TargaImage* pShown = Displayed_Image();
+    int levels = pShown == m_pProxy ? m_proxyLevels : 0;
+    width = pShown ? pShown->width << levels : 0;
+    height = pShown ? pShown->height << levels : 0;
+
+    // a preview of the same size as the image stands for the image
+    if (pShown == m_pProxy && pShown && m_pImage && (m_pImage->width >> levels) == pShown->width && (m_pImage->height >> levels) == pShown->height)
+    {
+        width = m_pImage->width;
+        height = m_pImage->height;
+    }// if
+}// Displayed_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Shrink a copy of the current image into the proxy, with as few
+//  halvings as fit it in c_proxySize.  Images that already fit get no proxy
+//  and are not previewed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::Sync_Proxy()
+{
+    delete m_pProxy;
+    m_pProxy = NULL;
+    m_proxyLevels = 0;
+    if (!m_pImage)
+        return;
+
+    while ((m_pImage->width >> m_proxyLevels) > c_proxySize || (m_pImage->height >> m_proxyLevels) > c_proxySize)
+        m_proxyLevels++;
+    if (m_proxyLevels > 0)
+    {
+        m_pProxy = new TargaImage(*m_pImage);
+        if (!m_pProxy->Half_Size_N(m_proxyLevels))
+        {
+            delete m_pProxy;
+            m_pProxy = NULL;
+        }// if
+    }// if
+}// Sync_Proxy
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a command on the proxy here on the gui thread, so its effect shows
+//  at once while the full resolution command is still queued or running.
+//  Commands that read files would block the gui while they decode them, so
+//  they aren't previewed; the proxy can't follow them and is dropped, and the
+//  image shows each result as it arrives until the queue is done.  The
+//  queue's worker may be running HandleCommand at the same time, so the
+//  handler keeps no parse state outside the call, and the proxy levels and
+//  the history are per thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::Preview(const char* sCommand)
+{
+    if (!m_pProxy || CScriptHandler::IsReadOnlyCommand(sCommand))
+        return;
+
+    if (!CScriptHandler::IsPreviewable(sCommand))
+    {
+        delete m_pProxy;
+        m_pProxy = NULL;
+        Invalidate();
+        Redraw();
+        return;
+    }// if
+
+    CScriptHandler::SetProxyLevels(m_proxyLevels);
+    CScriptHandler::HandleCommand(sCommand, m_pProxy);
+    CScriptHandler::SetProxyLevels(0);
+    Invalidate();
+    Redraw();
+}// Preview
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Show the displayed image afresh, dropping everything made from the
+//  image it replaces.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::Invalidate()
+{
+    TargaImage* pShown = Displayed_Image();
+    m_viewport.SetImage(pShown, pShown == m_pProxy ? m_proxyLevels : 0);
+    m_bDisplayValid = false;
+}// Invalidate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Redraw the window.  When the displayed image changes size the window
+//  is sized to it, as far as the screen allows, and the view fitted into it.
 //
 ///////////////////////////////////////////////////////////////////////////////
 void ImageWidget::Redraw()
 {
-    if (m_pImage)
-		parent()->size(Max(m_pImage->width, c_minWindowWidth), Max(m_pImage->height + c_buttonPaneHeight, c_minWindowHeight));
-    else
-        parent()->size(c_minWindowWidth, c_minWindowHeight);
+    int shownWidth, shownHeight;
+    Displayed_Size(shownWidth, shownHeight);
+    if (shownWidth != m_fittedWidth || shownHeight != m_fittedHeight)
+    {
+        m_fittedWidth = shownWidth;
+        m_fittedHeight = shownHeight;
+        parent()->size(Min(Max(shownWidth, c_minWindowWidth), Fl::w()), Min(Max(shownHeight + c_buttonPaneHeight, c_minWindowHeight), Fl::h()));
+        m_viewport.Fit(w(), h());
+        m_bDisplayValid = false;
+    }// if
 
     parent()->redraw();
 }// Redraw
@@ -110,14 +307,118 @@ void ImageWidget::Redraw()
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Handle commands entered in input box.
+//      Handle commands entered in input box.  The command is queued behind
+//  any still running, and previewed on the proxy until all of them are done.
 //
 ///////////////////////////////////////////////////////////////////////////////
 void ImageWidget::CommandCallback(Fl_Widget* pWidget, void* pData)
 {
     ImageWidget* pImageWidget = static_cast<ImageWidget*>(pData);
-    CScriptHandler::HandleCommand(static_cast<Fl_Input*>(pWidget)->value(), pImageWidget->m_pImage);
-    pImageWidget->Redraw();
+    const char* sCommand = static_cast<Fl_Input*>(pWidget)->value();
+    pImageWidget->m_pQueue->Submit(sCommand);
+    pImageWidget->m_pendingResults++;
+    pImageWidget->Preview(sCommand);
+
+    if (!Fl::has_timeout(ProgressCallback, pImageWidget))
+    {
+        pImageWidget->m_pProgress->value(0);
+        pImageWidget->m_pProgress->show();
+        pImageWidget->m_pCancelButton->show();
+        Fl::add_timeout(c_progressInterval, ProgressCallback, pImageWidget);
+    }// if
 }// CommandCallback
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Cancel the running command and everything queued after it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::CancelCallback(Fl_Widget* pWidget, void* pData)
+{
+    ImageWidget* pImageWidget = static_cast<ImageWidget*>(pData);
+    pImageWidget->m_pendingResults -= pImageWidget->m_pQueue->Cancel();
+}// CancelCallback
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Update the progress bar while commands run, hide it when they're done.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::ProgressCallback(void* pData)
+{
+    ImageWidget* pImageWidget = static_cast<ImageWidget*>(pData);
+    if (pImageWidget->m_pQueue->IsBusy())
+    {
+        pImageWidget->m_pProgress->value((float)(100.0 * pImageWidget->m_pQueue->Progress()));
+        Fl::repeat_timeout(c_progressInterval, ProgressCallback, pImageWidget);
+        return;
+    }// if
+
+    pImageWidget->m_pProgress->hide();
+    pImageWidget->m_pCancelButton->hide();
+}// ProgressCallback
+
+
+// a finished command on its way from the worker to the gui thread
+struct SCommandDone
+{
+    ImageWidget*            pWidget;
+    CCommandQueue::SResult  result;
+};// SCommandDone
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      A command finished on the worker thread, pass its result on to the gui
+//  thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::QueueCallback(const CCommandQueue::SResult& result, void* pData)
+{
+    SCommandDone* pDone = new SCommandDone;
+    pDone->pWidget = static_cast<ImageWidget*>(pData);
+    pDone->result = result;
+    Fl::awake(CommandDoneCallback, pDone);
+}// QueueCallback
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Swap the result of a command in.  Results arrive in the order the
+//  commands ran, so the image replaced is always the one the command started
+//  from.  The image only goes on screen once it is the result of the last
+//  command entered; until then the newer preview stays.  The proxy is then
+//  rebuilt from it so previews don't drift from the real image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ImageWidget::CommandDoneCallback(void* pData)
+{
+    SCommandDone* pDone = static_cast<SCommandDone*>(pData);
+    ImageWidget* pImageWidget = pDone->pWidget;
+    if (pDone->result.bChanged)
+    {
+        delete pImageWidget->m_pImage;
+        pImageWidget->m_pImage = pDone->result.pImage;
+    }// if
+
+    bool bChanged = pDone->result.bChanged;
+    delete pDone;
+    if (--pImageWidget->m_pendingResults > 0)
+    {
+        // without a preview the image itself is on screen
+        if (bChanged && !pImageWidget->m_pProxy)
+        {
+            pImageWidget->Invalidate();
+            pImageWidget->Redraw();
+        }// if
+        return;
+    }// if
+
+    // also brings back a proxy dropped for a command that wasn't previewed
+    pImageWidget->m_pendingResults = 0;
+    pImageWidget->Sync_Proxy();
+    pImageWidget->Invalidate();
+    pImageWidget->Redraw();
+}// CommandDoneCallback
@@ -12,11 +12,15 @@
 #ifndef _IMAGE_WIDGET_H_
 #define _IMAGE_WIDGET_H_
 
-#include <Fl/Fl.h>
-#include <Fl/Fl_Widget.h>
+#include <FL/Fl.H>
+#include <FL/Fl_Widget.H>
+#include "CommandQueue.h"
+#include "Viewport.h"
 
 class Fl_Box;
+class Fl_Button;
 class Fl_Input;
+class Fl_Progress;
 class TargaImage;
 
 class ImageWidget : public Fl_Widget
@@ -27,19 +31,45 @@ class ImageWidget : public Fl_Widget
         ~ImageWidget();
 
 	    void draw();	                    // FLTK draw function draws the current image.
+	    int handle(int event);              // zoom with the mouse wheel, scroll by dragging, fit on double click
 	    TargaImage* Get_Image();            // get the current image
 	    void Redraw();                      // redraw the image in the window
+	    void Invalidate();                  // the image changed, convert it again on the next draw
 
 
     private:
+        TargaImage* Displayed_Image();          // the proxy while results are pending, else the image
+        void Displayed_Size(int& width, int& height);
+        void Sync_Proxy();                      // rebuild the proxy from the image
+        void Preview(const char* sCommand);     // run a command on the proxy
+
         static void CommandCallback(Fl_Widget* pWidget, void* pData);           // command entered callback
+        static void CancelCallback(Fl_Widget* pWidget, void* pData);            // cancel button callback
+        static void ProgressCallback(void* pData);                              // progress bar timer
+        static void QueueCallback(const CCommandQueue::SResult& result, void* pData);   // a command finished, on the worker
+        static void CommandDoneCallback(void* pData);                           // a command finished, on the gui thread
 
 
     // members
     private:
         TargaImage* m_pImage;	                // The image to display (current image).
+        unsigned char*  m_pDisplay;             // the view rendered to RGB, widget sized, NULL until drawn
+        int         m_displayWidth;             // size of m_pDisplay
+        int         m_displayHeight;
+        bool        m_bDisplayValid;            // m_pDisplay shows the current view
+        CViewport   m_viewport;                 // zoom and scroll position over the displayed image
+        int         m_fittedWidth;              // displayed image size the view was last fitted to
+        int         m_fittedHeight;
+        int         m_dragX;                    // last mouse position while dragging
+        int         m_dragY;
+        TargaImage* m_pProxy;                   // the image after all commands entered so far, shrunk; NULL if not previewing
+        int         m_proxyLevels;              // halvings from m_pImage to m_pProxy
+        int         m_pendingResults;           // commands entered whose result hasn't arrived yet
         Fl_Box*     m_pStaticTextBox;           // static text
         Fl_Input*   m_pCommandInput;            // input box
+        Fl_Progress*    m_pProgress;            // progress of the running command, hidden when idle
+        Fl_Button*  m_pCancelButton;            // cancel the running and queued commands
+        CCommandQueue*  m_pQueue;               // runs the commands off the gui thread
 };
 
 
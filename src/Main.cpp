@@ -14,14 +14,17 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 
-#include <Fl/Fl.h>
-#include <Fl/Fl_Window.h>
+#include <FL/Fl.H>
+#include <FL/Fl_Window.H>
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
 #include "TargaImage.h"
 #include "ImageWidget.h"
 #include "ScriptHandler.h"
+#include "CommandLine.h"
+#include "ScriptServer.h"
 
 
 using namespace std;
@@ -80,6 +83,14 @@ int main(int argc, char *argv[])
 {
     int script_arg;
 
+    // before any thread is started, so only the server's signal thread takes them
+    if (CCommandLine::IsServing(argc, argv))
+        CScriptServer::BlockStopSignals();
+
+    // the script server and its client don't use the gui
+    if (CCommandLine::IsServerMode(argc, argv))
+        return CCommandLine::ServeOrSend(argc, argv);
+
     // Do argument processing. At the end of this, script_arg contains
     // the first non-switch argument, which if not 0 or argc is the
     // location of the script file name in the argument list.
@@ -99,17 +110,22 @@ int main(int argc, char *argv[])
     TargaImage* pImage = NULL;
     bool bHeadless = false;
 
+    // nobody looks at the image the last script leaves behind
+    int lastScript = CCommandLine::LastScript(argc, argv, script_arg);
+
     for (int i = script_arg; i < argc; ++i)
     {
         if (!strcmp(argv[i], c_sNames))                                 // display names
             DisplayNames();
+        else if (CCommandLine::HandleEngineSwitch(argc, argv, i))       // script engine setup
+            continue;
         else if (!bHeadless && !strcmp(argv[i], c_sHeadless))           // go headless
             bHeadless = true;
         else if (bHeadless && strcmp(argv[i], c_sHeadless))             // run script file
-            CScriptHandler::HandleScriptFile(argv[i], pImage);
+            CScriptHandler::HandleScriptFile(argv[i], pImage, i != lastScript);
         else
         {
-            cerr << "Usage:" << endl << "Project1 [-names] [-headless scriptFilenames . . .]" << endl;
+            CCommandLine::PrintUsage(cerr, "Project1", "[-names] [-headless scriptFilenames . . .]");
             return 0;
         }// else
     }// for
@@ -124,18 +140,25 @@ int main(int argc, char *argv[])
     if (!bHeadless)
     {
         // using the gui so create our window and the image widget
-        Fl_Window   window(350, 100, "CS559 Project 1");
+        Fl_Window   window(560, 100, "CS559 Project 1");
         Fl::visual(FL_RGB);
         window.begin();
-            ImageWidget* pWidget = new ImageWidget(0, 0, 350, 100, "Image");
+            ImageWidget* pWidget = new ImageWidget(0, 0, 560, 100, "Image");
             window.add(pWidget);
         window.end();
+        window.resizable(pWidget);
 
         window.show(argc, argv);
 
-        return Fl::run();
+        // commands run on a worker thread that hands its results back with Fl::awake
+        Fl::lock();
+
+        int result = Fl::run();
+        CCommandLine::Report(cout);
+        return result;
     }// else
 
+    CCommandLine::Report(cout);
     return 0;
 }// main
 
@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Premultiply.cpp
+//
+//      Implementation of the alpha conversions.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Premultiply.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PREMULTIPLY_SSE2
+    #include <emmintrin.h>
+#endif
+
+// the conversion tables, indexed by alpha * 256 + value
+struct STables
+{
+    unsigned char   aPremultiply[256 * 256];
+    unsigned char   aUnpremultiply[256 * 256];
+    unsigned char   aUnpremultiplyAlpha[256];       // alpha written next to un-premultiplied colors
+    unsigned char   aDisplay[256 * 256];            // the alpha 0 row is unused
+    bool            bOpaqueSaved;                   // saving leaves opaque pixels alone
+    bool            bOpaqueDisplayed;               // so does the display, but for alpha
+};// STables
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the tables once.  The arithmetic is libtarga's (loading and
+//  saving) and RGBA_To_RGB's (display) as it was, float for float.
+//
+///////////////////////////////////////////////////////////////////////////////
+static const STables& Tables()
+{
+    static const STables* s_pTables = []()
+    {
+        STables* pTables = new STables;
+        for (int a = 0; a < 256; a++)
+        {
+            float alpha = a / 255.0f;
+            pTables->aUnpremultiplyAlpha[a] = (unsigned char)(alpha > 1.0f ? 255.0f : alpha * 255.0f);
+
+            for (int v = 0; v < 256; v++)
+            {
+                pTables->aPremultiply[a * 256 + v] = (unsigned char)(((float)v / 255.0f) * ((float)a / 255.0f) * 255.0f);
+
+                float value = v / 255.0f;
+                if (alpha > 0.0001)
+                    value /= alpha;
+                pTables->aUnpremultiply[a * 256 + v] = (unsigned char)(value > 1.0f ? 255.0f : value * 255.0f);
+
+                int result = 0;
+                if (a)
+                {
+                    float alpha_scale = (float)255 / (float)a;
+                    result = Min(Max((int)floor(v * alpha_scale), 0), 255);
+                }// if
+                pTables->aDisplay[a * 256 + v] = (unsigned char)result;
+            }// for
+        }// for
+
+        pTables->bOpaqueSaved = pTables->aUnpremultiplyAlpha[255] == 255;
+        pTables->bOpaqueDisplayed = true;
+        for (int v = 0; v < 256; v++)
+        {
+            pTables->bOpaqueSaved = pTables->bOpaqueSaved && pTables->aUnpremultiply[255 * 256 + v] == v;
+            pTables->bOpaqueDisplayed = pTables->bOpaqueDisplayed && pTables->aDisplay[255 * 256 + v] == v;
+        }// for
+        return pTables;
+    }();
+
+    return *s_pTables;
+}// Tables
+
+
+#ifdef PREMULTIPLY_SSE2
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Whether the four pixels at rgba are all opaque.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline bool Opaque4(const unsigned char* rgba)
+{
+    const __m128i alphas = _mm_set1_epi32((int)0xFF000000);
+    __m128i pixels = _mm_loadu_si128((const __m128i*)rgba);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(pixels, alphas), alphas)) == 0xFFFF;
+}// Opaque4
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Loading.
+//
+///////////////////////////////////////////////////////////////////////////////
+const unsigned char* alpha_premultiply_table()
+{
+    return Tables().aPremultiply;
+}// alpha_premultiply_table
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Saving.
+//
+///////////////////////////////////////////////////////////////////////////////
+void alpha_unpremultiply_row(const unsigned char* rgba, unsigned char* out, int count)
+{
+    const STables& tables = Tables();
+    int i = 0;
+    while (i < count)
+    {
+#ifdef PREMULTIPLY_SSE2
+        if (tables.bOpaqueSaved && i + 4 <= count && Opaque4(rgba + i * 4))
+        {
+            if (out != rgba)
+                memcpy(out + i * 4, rgba + i * 4, 16);
+            i += 4;
+            continue;
+        }// if
+#endif
+        const unsigned char* pIn = rgba + i * 4;
+        unsigned char* pOut = out + i * 4;
+        const unsigned char* unpremultiply = tables.aUnpremultiply + pIn[3] * 256;
+        unsigned char alpha = tables.aUnpremultiplyAlpha[pIn[3]];
+        pOut[0] = unpremultiply[pIn[0]];
+        pOut[1] = unpremultiply[pIn[1]];
+        pOut[2] = unpremultiply[pIn[2]];
+        pOut[3] = alpha;
+        i++;
+    }// while
+}// alpha_unpremultiply_row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Display.
+//
+///////////////////////////////////////////////////////////////////////////////
+void alpha_display_row(const unsigned char* rgba, unsigned char* rgb, int count, const unsigned char* background)
+{
+    const STables& tables = Tables();
+    int i = 0;
+    while (i < count)
+    {
+#ifdef PREMULTIPLY_SSE2
+        if (tables.bOpaqueDisplayed && i + 4 <= count && Opaque4(rgba + i * 4))
+        {
+            for (int pixel = i; pixel < i + 4; pixel++)
+            {
+                rgb[pixel * 3] = rgba[pixel * 4];
+                rgb[pixel * 3 + 1] = rgba[pixel * 4 + 1];
+                rgb[pixel * 3 + 2] = rgba[pixel * 4 + 2];
+            }// for
+            i += 4;
+            continue;
+        }// if
+#endif
+        const unsigned char* pIn = rgba + i * 4;
+        unsigned char* pOut = rgb + i * 3;
+        if (!pIn[3])
+            memcpy(pOut, background, 3);
+        else
+        {
+            const unsigned char* unpremultiply = tables.aDisplay + pIn[3] * 256;
+            pOut[0] = unpremultiply[pIn[0]];
+            pOut[1] = unpremultiply[pIn[1]];
+            pOut[2] = unpremultiply[pIn[2]];
+        }// else
+        i++;
+    }// while
+}// alpha_display_row
@@ -0,0 +1,45 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Premultiply.h
+//
+//      Conversions between straight and premultiplied alpha.  Images are kept
+//  premultiplied; files hold straight colors and the display shows the
+//  colors un-premultiplied.  Each direction is a 64 KB table indexed by
+//  alpha * 256 + value, built once with exactly the float arithmetic the
+//  conversions used per pixel, so results are the same to the bit:
+//
+//      loading     (ubyte)(v / 255.0f * (a / 255.0f) * 255.0f)
+//      saving      v / 255.0f divided by a / 255.0f when that is above
+//                  0.0001, 255 past 1.0f, otherwise times 255.0f, truncated
+//      display     floor(v * (255.0f / a)) clamped, the background at a = 0
+//
+//  Saving passes alpha through its own 256 entry table for the same reason.
+//  The row functions convert spans of pixels; with SSE2 they find runs of
+//  four opaque pixels a vector at a time and copy those when the opaque table
+//  row is the identity, which it is for saving and display.
+//
+//  The interface is C so libtarga can use it.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PREMULTIPLY_H_
+#define _PREMULTIPLY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* premultiplied value of a straight one, at alpha * 256 + value */
+const unsigned char * alpha_premultiply_table( void );
+
+/* straight RGBA of count premultiplied pixels, as written to files; rgba and out may be the same */
+void alpha_unpremultiply_row( const unsigned char * rgba, unsigned char * out, int count );
+
+/* RGB of count premultiplied pixels for display, transparent ones take the background color */
+void alpha_display_row( const unsigned char * rgba, unsigned char * rgb, int count, const unsigned char * background );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _PREMULTIPLY_H_
@@ -0,0 +1,374 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Profiler.cpp
+//
+//      Implementation of CProfiler methods.  The allocation counter is only
+//  touched while the profiler is on.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Profiler.h"
+#include "TargaImage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+    #pragma comment(lib, "psapi.lib")
+#else
+    #include <time.h>
+    #include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// one command or span, times in nanoseconds since the profiler started
+struct SEvent
+{
+    const char* sName;
+    int         thread;
+    bool        bCommand;
+    long long   start;
+    long long   duration;
+    long long   cpu;
+    long long   allocated;
+    long long   peakGrowth;
+    long long   pixels;
+};// SEvent
+
+// totals for one command name
+struct SCommandTotals
+{
+    SCommandTotals() : calls(0), wall(0), cpu(0), allocated(0), peakGrowth(0), pixels(0) {}
+
+    long long   calls;
+    long long   wall;
+    long long   cpu;
+    long long   allocated;
+    long long   peakGrowth;
+    long long   pixels;
+};// SCommandTotals
+
+// constants
+const size_t                c_maxTraceEvents    = 1 << 20;      // events kept for the trace file
+
+// statics
+static atomic<bool>         s_bEnabled(false);
+static atomic<long long>    s_allocated(0);
+static atomic<int>          s_threadCount(0);
+static mutex                s_mutex;
+static string               s_sTraceFile;
+static map<string, SCommandTotals> s_totals;
+static vector<SEvent>       s_vEvents;
+static long long            s_droppedEvents = 0;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Keep an event for the trace file, if there is one and it has room.
+//  Must be called with the mutex held.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AddTraceEvent(const SEvent& event)
+{
+    if (s_sTraceFile.empty())
+        return;
+
+    if (s_vEvents.size() < c_maxTraceEvents)
+        s_vEvents.push_back(event);
+    else
+        ++s_droppedEvents;
+}// AddTraceEvent
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Clocks and counters.
+//
+///////////////////////////////////////////////////////////////////////////////
+static long long WallTime()
+{
+    static const chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+}// WallTime
+
+static long long CpuTime()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    ULARGE_INTEGER kernelTime, userTime;
+    kernelTime.LowPart = kernel.dwLowDateTime;
+    kernelTime.HighPart = kernel.dwHighDateTime;
+    userTime.LowPart = user.dwLowDateTime;
+    userTime.HighPart = user.dwHighDateTime;
+    return (long long)(kernelTime.QuadPart + userTime.QuadPart) * 100;
+#else
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+}// CpuTime
+
+static long long PeakResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return (long long)counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    #ifdef __APPLE__
+        return (long long)usage.ru_maxrss;
+    #else
+        return (long long)usage.ru_maxrss * 1024;
+    #endif
+#endif
+}// PeakResidentBytes
+
+static int ThreadId()
+{
+    static thread_local int id = ++s_threadCount;
+    return id;
+}// ThreadId
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Command scope.
+//
+///////////////////////////////////////////////////////////////////////////////
+CProfiler::CCommandScope::CCommandScope(const char* sName, TargaImage* const& pImage)
+    : m_sName(s_bEnabled ? sName : NULL), m_pImage(pImage), m_pixels(0),
+      m_startWall(0), m_startCpu(0), m_startAllocated(0), m_startPeak(0)
+{
+    if (!m_sName)
+        return;
+
+    if (pImage)
+        m_pixels = (long long)pImage->width * pImage->height;
+    m_startPeak = PeakResidentBytes();
+    m_startAllocated = s_allocated;
+    m_startCpu = CpuTime();
+    m_startWall = WallTime();
+}// CCommandScope
+
+CProfiler::CCommandScope::~CCommandScope()
+{
+    if (!m_sName)
+        return;
+
+    SEvent event;
+    event.duration = WallTime() - m_startWall;
+    event.cpu = CpuTime() - m_startCpu;
+    event.allocated = s_allocated - m_startAllocated;
+    event.peakGrowth = PeakResidentBytes() - m_startPeak;
+    event.sName = m_sName;
+    event.thread = ThreadId();
+    event.bCommand = true;
+    event.start = m_startWall;
+    event.pixels = m_pixels;
+    if (m_pImage)
+        event.pixels = Max(event.pixels, (long long)m_pImage->width * m_pImage->height);
+
+    lock_guard<mutex> lock(s_mutex);
+    SCommandTotals& total = s_totals[m_sName];
+    ++total.calls;
+    total.wall += event.duration;
+    total.cpu += event.cpu;
+    total.allocated += event.allocated;
+    total.peakGrowth += event.peakGrowth;
+    total.pixels += event.pixels;
+    AddTraceEvent(event);
+}// ~CCommandScope
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Thread span.
+//
+///////////////////////////////////////////////////////////////////////////////
+CProfiler::CSpan::CSpan(const char* sName)
+    : m_sName(s_bEnabled && !s_sTraceFile.empty() ? sName : NULL), m_start(0)
+{
+    if (m_sName)
+        m_start = WallTime();
+}// CSpan
+
+CProfiler::CSpan::~CSpan()
+{
+    if (!m_sName)
+        return;
+
+    SEvent event;
+    memset(&event, 0, sizeof(event));
+    event.duration = WallTime() - m_start;
+    event.sName = m_sName;
+    event.thread = ThreadId();
+    event.bCommand = false;
+    event.start = m_start;
+
+    lock_guard<mutex> lock(s_mutex);
+    AddTraceEvent(event);
+}// ~CSpan
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Turn the profiler on or off.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::SetEnabled(bool bEnabled)
+{
+    WallTime();
+    s_bEnabled = bEnabled;
+}// SetEnabled
+
+bool CProfiler::IsEnabled()
+{
+    return s_bEnabled;
+}// IsEnabled
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write a trace file as well as the summary.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::SetTraceFile(const char* sFilename)
+{
+    s_sTraceFile = sFilename;
+    SetEnabled(true);
+}// SetTraceFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Count bytes allocated by a command.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::CountAllocation(size_t bytes)
+{
+    if (s_bEnabled.load(memory_order_relaxed))
+        s_allocated.fetch_add((long long)bytes, memory_order_relaxed);
+}// CountAllocation
+
+void profiler_count_allocation(size_t bytes)
+{
+    CProfiler::CountAllocation(bytes);
+}// profiler_count_allocation
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print the summary and write the trace.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::Report(ostream& out)
+{
+    if (!s_bEnabled)
+        return;
+
+    PrintSummary(out);
+    if (!s_sTraceFile.empty())
+    {
+        if (WriteTrace(s_sTraceFile.c_str()))
+        {
+            out << "Wrote trace:  " << s_sTraceFile << endl;
+            if (s_droppedEvents)
+                out << "Trace full, " << s_droppedEvents << " later events dropped." << endl;
+        }// if
+        else
+            out << "Unable to write trace:  " << s_sTraceFile << endl;
+    }// if
+}// Report
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print one line per command name, most expensive first.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CProfiler::PrintSummary(ostream& out)
+{
+    map<string, SCommandTotals> totals;
+    {
+        lock_guard<mutex> lock(s_mutex);
+        totals = s_totals;
+    }
+
+    vector<pair<long long, string> > vOrder;
+    for (map<string, SCommandTotals>::iterator i = totals.begin(); i != totals.end(); ++i)
+        vOrder.push_back(make_pair(-i->second.wall, i->first));
+    sort(vOrder.begin(), vOrder.end());
+
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << fixed << setprecision(2);
+    out << left << setw(18) << "command" << right
+        << setw(8) << "calls"
+        << setw(12) << "wall ms"
+        << setw(12) << "cpu ms"
+        << setw(12) << "alloc MB"
+        << setw(12) << "peak +MB"
+        << setw(12) << "Mpix/s" << endl;
+
+    for (size_t i = 0; i < vOrder.size(); ++i)
+    {
+        const SCommandTotals& total = totals[vOrder[i].second];
+        double wallSeconds = total.wall / 1e9;
+        out << left << setw(18) << vOrder[i].second << right
+            << setw(8) << total.calls
+            << setw(12) << total.wall / 1e6
+            << setw(12) << total.cpu / 1e6
+            << setw(12) << total.allocated / 1048576.0
+            << setw(12) << total.peakGrowth / 1048576.0
+            << setw(12) << (wallSeconds > 0 ? total.pixels / wallSeconds / 1e6 : 0.0) << endl;
+    }// for
+
+    out.flags(flags);
+    out.precision(precision);
+}// PrintSummary
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write all events as complete ("X") trace events.  Times are in
+//  microseconds as the format expects.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CProfiler::WriteTrace(const char* sFilename)
+{
+    FILE* pFile = fopen(sFilename, "w");
+    if (!pFile)
+        return false;
+
+    lock_guard<mutex> lock(s_mutex);
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < s_vEvents.size(); ++i)
+    {
+        const SEvent& event = s_vEvents[i];
+        fprintf(pFile, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                event.sName, event.bCommand ? "command" : "span", event.thread, event.start / 1e3, event.duration / 1e3);
+        if (event.bCommand)
+            fprintf(pFile, ",\"args\":{\"cpu_us\":%.3f,\"allocated\":%lld,\"peak_growth\":%lld,\"pixels\":%lld}",
+                    event.cpu / 1e3, event.allocated, event.peakGrowth, event.pixels);
+        fprintf(pFile, "}%s\n", i + 1 < s_vEvents.size() ? "," : "");
+    }// for
+    fprintf(pFile, "]}\n");
+
+    return !fclose(pFile);
+}// WriteTrace
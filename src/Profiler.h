@@ -0,0 +1,96 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Profiler.h
+//
+//      Per-command profiling.  When enabled every script command records its
+//  wall time, CPU time, bytes allocated, growth of the peak resident set size
+//  and pixel throughput.  A summary table is printed on request, and all
+//  commands plus any spans recorded by worker threads can be written as a
+//  Chrome trace-event file (load it in chrome://tracing or Perfetto).
+//
+//  Allocation and CPU counters are process wide, so commands running at the
+//  same time (script server) see each other's work.  Bytes allocated count
+//  libtarga's buffers, and operator new only in executables that link
+//  CountingAllocator.cpp; the library leaves the global allocator alone.
+//
+//  The summary keeps running totals per command name.  The trace keeps at
+//  most c_maxTraceEvents events, later ones are counted and dropped, so a
+//  long running server doesn't grow without bound.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stddef.h>
+#include <iostream>
+
+class TargaImage;
+
+class CProfiler
+{
+    // types
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Records one script command from construction to destruction.  The
+        //  pixel count is the larger of the image before and after.  Does nothing
+        //  if the profiler is off or sName is NULL.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        class CCommandScope
+        {
+            public:
+                CCommandScope(const char* sName, TargaImage* const& pImage);
+                ~CCommandScope();
+
+            private:
+                const char*         m_sName;
+                TargaImage* const&  m_pImage;
+                long long           m_pixels;
+                long long           m_startWall;
+                long long           m_startCpu;
+                long long           m_startAllocated;
+                long long           m_startPeak;
+        };// CCommandScope
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Records a span of work on the calling thread for the trace file only.
+        //  sName must outlive the profiler, use string literals.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        class CSpan
+        {
+            public:
+                CSpan(const char* sName);
+                ~CSpan();
+
+            private:
+                const char*         m_sName;
+                long long           m_start;
+        };// CSpan
+
+    // methods
+    public:
+        static void SetEnabled(bool bEnabled);
+        static bool IsEnabled();
+        static void SetTraceFile(const char* sFilename);       // also enables the profiler
+        static void CountAllocation(size_t bytes);              // counted only while the profiler is on
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Print the summary table and write the trace file, if any.  Does
+        //  nothing if the profiler is off.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Report(std::ostream& out);
+
+    private:
+        static void PrintSummary(std::ostream& out);
+        static bool WriteTrace(const char* sFilename);
+};// CProfiler
+
+extern "C" void profiler_count_allocation(size_t bytes);       // CountAllocation, for libtarga
+
+#endif // _PROFILER_H_
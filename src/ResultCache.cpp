@@ -0,0 +1,636 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ResultCache.cpp
+//
+//      Implementation of CResultCache methods.  The cache directory holds one
+//  file per entry plus a small text index recording entry sizes and the order
+//  in which they were last used, and a lock file serializing updates of the
+//  index between processes.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ResultCache.h"
+#include "TargaImage.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <direct.h>
+    #include <process.h>
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/file.h>
+    #include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// constants
+const char                  c_sDefaultDirectory[]   = ".imagecache";            // used when IMAGEEDITING_CACHE_DIR is not set
+const unsigned long long    c_defaultMaxBytes       = 1024ULL << 20;            // default size cap
+const char                  c_sIndexName[]          = "index.txt";              // index file in the cache directory
+const char                  c_sLockName[]           = "index.lock";             // locked while the index is updated
+const size_t                c_useBatch              = 64;                       // hits merged into the index at once
+const char                  c_entryMagic[4]         = { 'I', 'R', 'C', '1' };   // entry file signature
+const size_t                c_hashChunk             = 1 << 20;                  // bytes hashed per task
+
+const CacheKey              c_prime1                = 0x9E3779B185EBCA87ULL;
+const CacheKey              c_prime2                = 0xC2B2AE3D27D4EB4FULL;
+const CacheKey              c_prime3                = 0x165667B19E3779F9ULL;
+const CacheKey              c_prime4                = 0x85EBCA77C2B2AE63ULL;
+const CacheKey              c_prime5                = 0x27D4EB2F165667C5ULL;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hash helpers.  The mixing follows the structure of xxHash64.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline CacheKey Rotate(CacheKey value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}// Rotate
+
+static inline CacheKey Read64(const unsigned char* pData)
+{
+    CacheKey value;
+    memcpy(&value, pData, sizeof(value));
+    return value;
+}// Read64
+
+static inline CacheKey Round(CacheKey accumulator, CacheKey input)
+{
+    accumulator += input * c_prime2;
+    return Rotate(accumulator, 31) * c_prime1;
+}// Round
+
+static inline CacheKey Merge(CacheKey hash, CacheKey lane)
+{
+    hash ^= Round(0, lane);
+    return hash * c_prime1 + c_prime4;
+}// Merge
+
+static CacheKey HashChunk(const unsigned char* pData, size_t size, CacheKey seed)
+{
+    const unsigned char* pEnd = pData + size;
+    CacheKey hash;
+
+    if (size >= 32)
+    {
+        CacheKey lane1 = seed + c_prime1 + c_prime2,
+                 lane2 = seed + c_prime2,
+                 lane3 = seed,
+                 lane4 = seed - c_prime1;
+
+        for (; pData + 32 <= pEnd; pData += 32)
+        {
+            lane1 = Round(lane1, Read64(pData));
+            lane2 = Round(lane2, Read64(pData + 8));
+            lane3 = Round(lane3, Read64(pData + 16));
+            lane4 = Round(lane4, Read64(pData + 24));
+        }// for
+
+        hash = Rotate(lane1, 1) + Rotate(lane2, 7) + Rotate(lane3, 12) + Rotate(lane4, 18);
+        hash = Merge(hash, lane1);
+        hash = Merge(hash, lane2);
+        hash = Merge(hash, lane3);
+        hash = Merge(hash, lane4);
+    }// if
+    else
+        hash = seed + c_prime5;
+
+    hash += size;
+
+    for (; pData + 8 <= pEnd; pData += 8)
+        hash = Rotate(hash ^ Round(0, Read64(pData)), 27) * c_prime1 + c_prime4;
+
+    for (; pData < pEnd; ++pData)
+        hash = Rotate(hash ^ (*pData * c_prime5), 11) * c_prime1;
+
+    hash ^= hash >> 33;
+    hash *= c_prime2;
+    hash ^= hash >> 29;
+    hash *= c_prime3;
+    hash ^= hash >> 32;
+    return hash;
+}// HashChunk
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Create a directory, it is not an error if it exists.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void MakeDirectory(const char* sPath)
+{
+#ifdef _WIN32
+    _mkdir(sPath);
+#else
+    mkdir(sPath, 0755);
+#endif
+}// MakeDirectory
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Exclusive lock on a file, held while the index is read and rewritten
+//  so that processes sharing the directory take turns.  Released when the
+//  object is destroyed.  If the lock file can't be opened the update goes
+//  ahead unlocked, as it would have without the lock.
+//
+///////////////////////////////////////////////////////////////////////////////
+class CFileLock
+{
+    public:
+        CFileLock(const string& sPath)
+        {
+#ifdef _WIN32
+            m_hFile = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_hFile != INVALID_HANDLE_VALUE)
+            {
+                OVERLAPPED overlapped = {};
+                LockFileEx(m_hFile, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+            }// if
+#else
+            m_file = open(sPath.c_str(), O_RDWR | O_CREAT, 0644);
+            if (m_file >= 0)
+                while (flock(m_file, LOCK_EX) && errno == EINTR)
+                    ;
+#endif
+        }// CFileLock
+
+        ~CFileLock()
+        {
+#ifdef _WIN32
+            if (m_hFile != INVALID_HANDLE_VALUE)
+                CloseHandle(m_hFile);
+#else
+            if (m_file >= 0)
+                close(m_file);
+#endif
+        }// ~CFileLock
+
+    private:
+        CFileLock(const CFileLock&);
+        CFileLock& operator=(const CFileLock&);
+
+#ifdef _WIN32
+        HANDLE  m_hFile;
+#else
+        int     m_file;
+#endif
+};// CFileLock
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the id of this process, which makes temporary names unique.
+//
+///////////////////////////////////////////////////////////////////////////////
+static long ProcessId()
+{
+#ifdef _WIN32
+    return (long)_getpid();
+#else
+    return (long)getpid();
+#endif
+}// ProcessId
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the process wide cache.
+//
+///////////////////////////////////////////////////////////////////////////////
+CResultCache& CResultCache::Instance()
+{
+    static CResultCache cache;
+    return cache;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The cache is enabled, in the directory named by
+//  IMAGEEDITING_CACHE_DIR or in the working directory.
+//
+///////////////////////////////////////////////////////////////////////////////
+CResultCache::CResultCache() : m_bEnabled(true), m_bOpen(false), m_maxBytes(c_defaultMaxBytes), m_totalBytes(0),
+                               m_clock(0), m_hits(0), m_misses(0), m_stores(0), m_evictions(0)
+{
+    const char* sDirectory = getenv("IMAGEEDITING_CACHE_DIR");
+    m_sDirectory = sDirectory && *sDirectory ? sDirectory : c_sDefaultDirectory;
+}// CResultCache
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Merges the hits not yet in the index.
+//
+///////////////////////////////////////////////////////////////////////////////
+CResultCache::~CResultCache()
+{
+    Flush();
+}// ~CResultCache
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the cache directory.  Has no effect once the cache has been used.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::SetDirectory(const char* sDirectory)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_bOpen && sDirectory)
+        m_sDirectory = sDirectory;
+}// SetDirectory
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the size cap.  Has no effect once the cache has been used.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::SetMaxBytes(unsigned long long maxBytes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_bOpen)
+        m_maxBytes = maxBytes;
+}// SetMaxBytes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Enable or disable the cache.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::SetEnabled(bool bEnabled)
+{
+    m_bEnabled = bEnabled;
+}// SetEnabled
+
+bool CResultCache::IsEnabled() const
+{
+    return m_bEnabled;
+}// IsEnabled
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Check whether a result is cached.  Counts towards the hit statistics.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CResultCache::Contains(CacheKey key)
+{
+    lock_guard<mutex> lock(m_mutex);
+    Open();
+
+    map<CacheKey, SEntry>::iterator entry = m_entries.find(key);
+    if (entry == m_entries.end())
+    {
+        ++m_misses;
+        return false;
+    }// if
+
+    ++m_hits;
+    SUse use = { key, 0 };
+    m_vUses.push_back(use);
+    if (m_vUses.size() >= c_useBatch)
+        Sync();
+    return true;
+}// Contains
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read a cached result.  Return a new image which must be deleted by the
+//  caller, or NULL if the entry is missing or damaged.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* CResultCache::Load(CacheKey key)
+{
+    lock_guard<mutex> lock(m_mutex);
+    Open();
+
+    map<CacheKey, SEntry>::iterator entry = m_entries.find(key);
+    if (entry == m_entries.end())
+        return NULL;
+
+    TargaImage* pImage = NULL;
+    FILE* pFile = fopen(EntryPath(key).c_str(), "rb");
+    if (pFile)
+    {
+        char magic[4];
+        int size[2];
+        if (fread(magic, 1, 4, pFile) == 4 && !memcmp(magic, c_entryMagic, 4) &&
+            fread(size, sizeof(int), 2, pFile) == 2 && size[0] > 0 && size[1] > 0)
+        {
+            pImage = new TargaImage(size[0], size[1]);
+            size_t bytes = (size_t)size[0] * size[1] * 4;
+            if (fread(pImage->data, 1, bytes, pFile) != bytes)
+            {
+                delete pImage;
+                pImage = NULL;
+            }// if
+        }// if
+        fclose(pFile);
+    }// if
+
+    if (!pImage)
+    {
+        // someone removed or truncated the file, forget about it
+        remove(EntryPath(key).c_str());
+        m_vRemoved.push_back(key);
+        Sync();
+    }// if
+
+    return pImage;
+}// Load
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Store a result.  The entry is written under a temporary name and then
+//  renamed so a reader never sees a partial file, then added to the index.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Store(CacheKey key, const TargaImage& image)
+{
+    if (!image.data)
+        return;
+
+    lock_guard<mutex> lock(m_mutex);
+    Open();
+
+    size_t bytes = (size_t)image.width * image.height * 4;
+    unsigned long long size = sizeof(c_entryMagic) + 2 * sizeof(int) + bytes;
+    if (size > m_maxBytes || m_entries.count(key))
+        return;
+
+    string sPath = EntryPath(key);
+    char sSuffix[32];
+    sprintf(sSuffix, ".%ld.tmp", ProcessId());
+    string sTemporary = sPath + sSuffix;
+    FILE* pFile = fopen(sTemporary.c_str(), "wb");
+    if (!pFile)
+        return;
+
+    int dimensions[2] = { image.width, image.height };
+    bool bWritten = fwrite(c_entryMagic, 1, 4, pFile) == 4 &&
+                    fwrite(dimensions, sizeof(int), 2, pFile) == 2 &&
+                    fwrite(image.data, 1, bytes, pFile) == bytes;
+    bWritten = !fclose(pFile) && bWritten;
+
+    remove(sPath.c_str());
+    if (!bWritten || rename(sTemporary.c_str(), sPath.c_str()))
+    {
+        remove(sTemporary.c_str());
+        return;
+    }// if
+
+    ++m_stores;
+    SUse use = { key, size };
+    m_vUses.push_back(use);
+    Sync();
+}// Store
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Merge the hits not yet in the index into it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Flush()
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_bOpen && (!m_vUses.empty() || !m_vRemoved.empty()))
+        Sync();
+}// Flush
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Print hit statistics, if the cache was used at all.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::PrintStatistics(ostream& out)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_hits && !m_misses)
+        return;
+
+    out << "Result cache:  " << m_hits << " hits, " << m_misses << " misses ("
+        << (int)(100.0 * m_hits / (m_hits + m_misses) + 0.5) << "% hit rate), "
+        << m_stores << " stored, " << m_evictions << " evicted, "
+        << (m_totalBytes >> 20) << " of " << (m_maxBytes >> 20) << " MB used." << endl;
+}// PrintStatistics
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hash a buffer.  Large buffers are split into fixed size chunks which
+//  are hashed in parallel.
+//
+///////////////////////////////////////////////////////////////////////////////
+CacheKey CResultCache::HashBytes(const void* pData, size_t size, CacheKey seed)
+{
+    const unsigned char* pBytes = static_cast<const unsigned char*>(pData);
+    size_t chunks = (size + c_hashChunk - 1) / c_hashChunk;
+    if (chunks <= 1)
+        return HashChunk(pBytes, size, seed);
+
+    vector<CacheKey> vChunkHashes(chunks);
+    CThreadPool::ParallelFor(0, (int)chunks, 1, [&](int first, int last)
+    {
+        for (int chunk = first; chunk < last; ++chunk)
+        {
+            size_t offset = chunk * c_hashChunk;
+            vChunkHashes[chunk] = HashChunk(pBytes + offset, Min(c_hashChunk, size - offset), seed);
+        }// for
+    });
+
+    return HashChunk(reinterpret_cast<const unsigned char*>(&vChunkHashes[0]), chunks * sizeof(CacheKey), seed ^ size);
+}// HashBytes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hash the dimensions and pixels of an image.
+//
+///////////////////////////////////////////////////////////////////////////////
+CacheKey CResultCache::HashImage(const TargaImage& image)
+{
+    int dimensions[2] = { image.width, image.height };
+    CacheKey seed = HashChunk(reinterpret_cast<const unsigned char*>(dimensions), sizeof(dimensions), 0);
+    if (!image.data)
+        return seed;
+
+    return HashBytes(image.data, (size_t)image.width * image.height * 4, seed);
+}// HashImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Hash the contents of a file.  Return false if it can't be read.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CResultCache::HashFile(const char* sFilename, CacheKey& key)
+{
+    if (!sFilename)
+        return false;
+
+    FILE* pFile = fopen(sFilename, "rb");
+    if (!pFile)
+        return false;
+
+    vector<unsigned char> vContents;
+    unsigned char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+        vContents.insert(vContents.end(), buffer, buffer + count);
+
+    bool bResult = !ferror(pFile);
+    fclose(pFile);
+
+    key = HashBytes(vContents.empty() ? NULL : &vContents[0], vContents.size(), 0);
+    return bResult;
+}// HashFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Create the cache directory and read the index, once.  Must be called
+//  with the mutex held.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Open()
+{
+    if (m_bOpen)
+        return;
+    m_bOpen = true;
+
+    MakeDirectory(m_sDirectory.c_str());
+    Sync();
+}// Open
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Re-read the index under the lock, since other processes may have
+//  changed it, apply this process's removals, stores and hits in order, evict
+//  past the cap and write the result back.  Uses are stamped from the largest
+//  clock in the index, so the recency order is shared by all processes.  Must
+//  be called with the mutex held.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Sync()
+{
+    CFileLock lock(m_sDirectory + "/" + c_sLockName);
+
+    m_entries.clear();
+    m_totalBytes = 0;
+    m_clock = 0;
+
+    ifstream index((m_sDirectory + "/" + c_sIndexName).c_str());
+    CacheKey key;
+    SEntry entry;
+    while (index >> hex >> key >> dec >> entry.size >> entry.lastUse)
+    {
+        m_entries[key] = entry;
+        m_clock = Max(m_clock, entry.lastUse);
+    }// while
+    index.close();
+
+    for (size_t i = 0; i < m_vRemoved.size(); ++i)
+        m_entries.erase(m_vRemoved[i]);
+
+    for (size_t i = 0; i < m_vUses.size(); ++i)
+    {
+        map<CacheKey, SEntry>::iterator used = m_entries.find(m_vUses[i].key);
+        if (m_vUses[i].size)
+        {
+            SEntry newEntry = { m_vUses[i].size, ++m_clock };
+            m_entries[m_vUses[i].key] = newEntry;
+        }// if
+        else if (used != m_entries.end())
+            used->second.lastUse = ++m_clock;
+    }// for
+
+    for (map<CacheKey, SEntry>::const_iterator i = m_entries.begin(); i != m_entries.end(); ++i)
+        m_totalBytes += i->second.size;
+
+    m_vUses.clear();
+    m_vRemoved.clear();
+    Evict(m_maxBytes);
+    WriteIndex();
+}// Sync
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rewrite the index file.  Must be called with the mutex and the lock
+//  held.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::WriteIndex()
+{
+    string sIndex = m_sDirectory + "/" + c_sIndexName;
+    char sSuffix[32];
+    sprintf(sSuffix, ".%ld.tmp", ProcessId());
+    string sTemporary = sIndex + sSuffix;
+
+    {
+        ofstream index(sTemporary.c_str());
+        for (map<CacheKey, SEntry>::const_iterator i = m_entries.begin(); i != m_entries.end(); ++i)
+            index << hex << i->first << dec << ' ' << i->second.size << ' ' << i->second.lastUse << '\n';
+    }
+
+    remove(sIndex.c_str());
+    rename(sTemporary.c_str(), sIndex.c_str());
+}// WriteIndex
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Remove least recently used entries until at most maxBytes are in use.
+//  Must be called with the mutex held.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CResultCache::Evict(unsigned long long maxBytes)
+{
+    while (m_totalBytes > maxBytes && !m_entries.empty())
+    {
+        map<CacheKey, SEntry>::iterator oldest = m_entries.begin();
+        for (map<CacheKey, SEntry>::iterator i = m_entries.begin(); i != m_entries.end(); ++i)
+            if (i->second.lastUse < oldest->second.lastUse)
+                oldest = i;
+
+        remove(EntryPath(oldest->first).c_str());
+        m_totalBytes -= oldest->second.size;
+        m_entries.erase(oldest);
+        ++m_evictions;
+    }// while
+}// Evict
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the file name of an entry.
+//
+///////////////////////////////////////////////////////////////////////////////
+string CResultCache::EntryPath(CacheKey key) const
+{
+    char sName[32];
+    sprintf(sName, "/%016llx.img", key);
+    return m_sDirectory + sName;
+}// EntryPath
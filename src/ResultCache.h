@@ -0,0 +1,101 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ResultCache.h
+//
+//      On-disk cache of command results.  Each entry is the image produced by
+//  one script step, keyed by a hash of the step's input (pixels or file), the
+//  command with its arguments and the engine version.  Re-running a script on
+//  unchanged assets skips every step whose result is already cached.
+//
+//      Several processes may share a cache directory.  The index on disk is
+//  the shared record: every change re-reads it and merges this process's
+//  stores, removals and hits into it under a file lock.  Hits are only
+//  counted in memory and merged in batches.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _RESULT_CACHE_H_
+#define _RESULT_CACHE_H_
+
+#include <stddef.h>
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+
+class TargaImage;
+
+typedef unsigned long long CacheKey;
+
+class CResultCache
+{
+    // methods
+    public:
+        static CResultCache& Instance();                                        // the process wide cache
+
+        void SetDirectory(const char* sDirectory);                              // set before first use
+        void SetMaxBytes(unsigned long long maxBytes);                          // size cap, set before first use
+        void SetEnabled(bool bEnabled);
+        bool IsEnabled() const;
+
+        bool Contains(CacheKey key);                                            // look up a key, counts a hit or a miss
+        TargaImage* Load(CacheKey key);                                         // read an entry, NULL if it is gone
+        void Store(CacheKey key, const TargaImage& image);                      // add an entry, evicting old ones past the cap
+        void Flush();                                                           // merge pending hits into the index
+
+        void PrintStatistics(std::ostream& out);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Fast non-cryptographic 64 bit hashes.  Buffers are hashed in fixed
+        //  size chunks on several threads and the chunk hashes are hashed again,
+        //  so a key does not depend on the number of threads.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static CacheKey HashBytes(const void* pData, size_t size, CacheKey seed);
+        static CacheKey HashImage(const TargaImage& image);
+        static bool HashFile(const char* sFilename, CacheKey& key);
+
+    private:
+        CResultCache();
+        ~CResultCache();
+
+        void Open();                                // create the directory and read the index
+        void Sync();                                // merge pending changes into the index on disk
+        void WriteIndex();
+        void Evict(unsigned long long maxBytes);    // drop least recently used entries
+        std::string EntryPath(CacheKey key) const;
+
+    // members
+    private:
+        struct SEntry
+        {
+            unsigned long long  size;       // bytes on disk
+            unsigned long long  lastUse;    // value of m_clock at the last hit or store
+        };
+
+        struct SUse
+        {
+            CacheKey            key;
+            unsigned long long  size;       // bytes of a stored entry, 0 for a hit
+        };
+
+        std::mutex                  m_mutex;
+        bool                        m_bEnabled;
+        bool                        m_bOpen;
+        std::string                 m_sDirectory;
+        unsigned long long          m_maxBytes;
+        unsigned long long          m_totalBytes;
+        unsigned long long          m_clock;
+        std::map<CacheKey, SEntry>  m_entries;    // as of the last sync
+        std::vector<SUse>           m_vUses;        // hits and stores not yet merged, in order
+        std::vector<CacheKey>       m_vRemoved;     // damaged entries not yet merged
+
+        unsigned long long          m_hits;
+        unsigned long long          m_misses;
+        unsigned long long          m_stores;
+        unsigned long long          m_evictions;
+};// CResultCache
+
+#endif // _RESULT_CACHE_H_
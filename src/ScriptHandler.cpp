@@ -14,12 +14,19 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <stdlib.h>
+#include <sstream>
 #include "TargaImage.h"
+#include "ResultCache.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "History.h"
+#include "ImageStats.h"
 
 using namespace std;
 
 // constants
-const int       c_maxLineLength         = 1000;                         // maximum length of a command in a script
+const int       c_maxScriptDepth        = 32;                           // maximum nesting of "run" commands when planning a script
 const char      c_sWhiteSpace[]         = " \t\n\r"; 
 const char      c_asCommands[][32]      = { "load",                     // valid commands
                                             "save",
@@ -35,6 +42,7 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "dither-pattern",
                                             "dither-color",
                                             "filter-box",
+                                            "filter-box-n",
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
@@ -42,6 +50,7 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "filter-enhance",
                                             "npr-paint",
                                             "half",
+                                            "half-n",
                                             "double",
                                             "scale",
                                             "comp-over",
@@ -49,9 +58,29 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "comp-out",
                                             "comp-atop",
                                             "comp-xor",
+                                            "comp-stack",
                                             "diff",
-                                            "rotate"
+                                            "rotate",
+                                            "mipmap",
+                                            "undo",
+                                            "redo",
+                                            "stats",
+                                            "compare"
                                           };
+const char      c_asCompositeOps[][16]  = { "over",                     // operators of "comp-stack", in ECompositeOp order
+                                            "in",
+                                            "out",
+                                            "atop",
+                                            "xor"
+                                          };
+const char      c_asResizeKernels[][16] = { "box",                      // resampling kernels of "scale", in EResizeKernel order
+                                            "bartlett",
+                                            "mitchell",
+                                            "lanczos3"
+                                          };
+const char      c_asDitherPatterns[][16] = { "bayer",                   // built in patterns of "dither-pattern", in EDitherPattern order,
+                                             "cluster"                  // any other argument names a threshold tile
+                                           };
 
 enum ECommands          // command ids
 {
@@ -69,6 +98,7 @@ enum ECommands          // command ids
     DITHER_PATTERN,
     DITHER_COLOR,
     FILTER_BOX,
+    FILTER_BOX_N,
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
@@ -76,6 +106,7 @@ enum ECommands          // command ids
     FILTER_ENHANCE,
     NPR_PAINT,
     HALF,
+    HALF_N,
     DOUBLE,
     SCALE,
     COMP_OVER,
@@ -83,11 +114,340 @@ enum ECommands          // command ids
     COMP_OUT,
     COMP_ATOP,
     COMP_XOR,
+    COMP_STACK,
     DIFF,
     ROTATE,
+    MIPMAP,
+    UNDO,
+    REDO,
+    STATS,
+    COMPARE,
     NUM_COMMANDS
 };// ECommands
 
+enum EDitherPattern
+{
+    PATTERN_BAYER,
+    PATTERN_CLUSTER
+};// EDitherPattern
+
+// command properties used when planning a script
+const unsigned  c_observer              = 0x01;                         // reads the image without modifying it
+const unsigned  c_replacesImage         = 0x02;                         // produces a new image without reading the current one
+const unsigned  c_barrier               = 0x04;                         // everything before it must run
+const unsigned  c_fileOperand           = 0x08;                         // first argument names a file that is read
+const unsigned  c_uncacheable           = 0x10;                         // result may differ between runs
+const unsigned  c_fileList              = 0x20;                         // arguments after the first name files that are read
+
+// statics
+bool CScriptHandler::s_bLazy = false;
+static thread_local int s_proxyLevels = 0;      // halvings applied to loaded images, see SetProxyLevels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the id of the command at the start of the given command string.
+//  NUM_COMMANDS is returned if the command is not recognized.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int FindCommand(const char* sCommand)
+{
+    size_t start = strspn(sCommand, c_sWhiteSpace);
+    size_t length = strcspn(sCommand + start, c_sWhiteSpace);
+
+    for (int command = 0; command < NUM_COMMANDS; ++command)
+        if (strlen(c_asCommands[command]) == length && !strncmp(sCommand + start, c_asCommands[command], length))
+            return command;
+
+    return NUM_COMMANDS;
+}// FindCommand
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the next white space separated token of a command line and
+//  move sPosition past it, or return NULL at the end of the line.  Works like
+//  strtok, but the position belongs to the caller, so the server workers and
+//  the gui's preview can parse commands at the same time.
+//
+///////////////////////////////////////////////////////////////////////////////
+static char* NextToken(char*& sPosition)
+{
+    char* sToken = sPosition + strspn(sPosition, c_sWhiteSpace);
+    if (*sToken == '\0')
+    {
+        sPosition = sToken;
+        return NULL;
+    }// if
+
+    sPosition = sToken + strcspn(sToken, c_sWhiteSpace);
+    if (*sPosition != '\0')
+        *sPosition++ = '\0';
+    return sToken;
+}// NextToken
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the resampling kernel with the given name.  A missing name gives
+//  the default Bartlett kernel, an unknown one gives -1.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int FindResizeKernel(const char* sKernel)
+{
+    if (!sKernel)
+        return TargaImage::RESIZE_BARTLETT;
+
+    for (int kernel = 0; kernel < (int)(sizeof(c_asResizeKernels) / sizeof(c_asResizeKernels[0])); ++kernel)
+        if (!strcmp(sKernel, c_asResizeKernels[kernel]))
+            return kernel;
+
+    return -1;
+}// FindResizeKernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the compositing operator with the given name, -1 if there is none.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int FindCompositeOp(const char* sOperator)
+{
+    if (!sOperator)
+        return -1;
+
+    for (int op = 0; op < (int)(sizeof(c_asCompositeOps) / sizeof(c_asCompositeOps[0])); ++op)
+        if (!strcmp(sOperator, c_asCompositeOps[op]))
+            return op;
+
+    return -1;
+}// FindCompositeOp
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the built in dither pattern with the given name, -1 if there is
+//  none.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int FindDitherPattern(const char* sPattern)
+{
+    if (!sPattern)
+        return -1;
+
+    for (int pattern = 0; pattern < (int)(sizeof(c_asDitherPatterns) / sizeof(c_asDitherPatterns[0])); ++pattern)
+        if (!strcmp(sPattern, c_asDitherPatterns[pattern]))
+            return pattern;
+
+    return -1;
+}// FindDitherPattern
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the planning properties of a command.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned CommandFlags(int command)
+{
+    switch (command)
+    {
+        case LOAD:          return c_replacesImage | c_fileOperand;
+        case SAVE:
+        case MIPMAP:
+        case STATS:         return c_observer;
+        case COMPARE:       return c_observer | c_fileOperand;
+        case COMP_OVER:
+        case COMP_IN:
+        case COMP_OUT:
+        case COMP_ATOP:
+        case COMP_XOR:
+        case DIFF:
+        case DITHER_PATTERN:  return c_fileOperand;         // unless it names a built in pattern
+        case COMP_STACK:    return c_fileList;
+        case UNDO:
+        case REDO:          return c_barrier | c_uncacheable;   // depend on the history, not the script
+        case NUM_COMMANDS:  return c_barrier;       // report parse errors where they happen
+        default:            return 0;
+    }// switch
+}// CommandFlags
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Commands that leave the image untouched.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::IsReadOnlyCommand(const char* sCommand)
+{
+    return sCommand && (CommandFlags(FindCommand(sCommand)) & c_observer);
+}// IsReadOnlyCommand
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Commands cheap enough to run on a proxy on the gui thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::IsPreviewable(const char* sCommand)
+{
+    if (!sCommand)
+        return false;
+
+    int command = FindCommand(sCommand);
+    return command != RUN && !(CommandFlags(command) & (c_observer | c_replacesImage | c_fileOperand | c_fileList));
+}// IsPreviewable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load an image a command reads, shrunk by the given proxy levels.  The
+//  levels are the calling thread's, pool threads must be passed them.  Images
+//  too small to shrink are kept as they are.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+static TargaImage* Load_Operand(char* sFilename, int levels = s_proxyLevels)
+{
+    TargaImage* pImage = TargaImage::Load_Image(sFilename);
+    if (pImage && levels > 0)
+        pImage->Half_Size_N(levels);
+    return pImage;
+}// Load_Operand
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Mark the live commands of a straight-line program for lazy evaluation.
+//  The program is walked backwards: a command is live only if its result can
+//  reach an observer (a "save", or the caller when bResultObserved is set)
+//  before a "load" replaces the image.  Dead commands are skipped, so a "load"
+//  whose image is never used is never decoded, and a live "load" is decoded
+//  just before the first command that needs its pixels.  Return the number of
+//  dead commands.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int PlanLazy(const vector<string>& vsProgram, bool bResultObserved, vector<bool>& vbLive)
+{
+    int dead = 0;
+    bool bNeeded = bResultObserved;
+    for (int i = (int)vsProgram.size() - 1; i >= 0; --i)
+    {
+        unsigned flags = CommandFlags(FindCommand(vsProgram[i].c_str()));
+
+        if (flags & (c_observer | c_barrier))
+            bNeeded = true;
+        else if (bNeeded)
+            bNeeded = !(flags & c_replacesImage);
+        else
+        {
+            vbLive[i] = false;
+            ++dead;
+        }// else
+    }// for
+
+    return dead;
+}// PlanLazy
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Compute the cache key of a script step from the key of its input image,
+//  the command and its arguments, the contents of the file it reads (not the
+//  file's name) and the engine version.  Return false if the file can't be
+//  read.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool StepKey(const char* sCommand, CacheKey input, CacheKey& key)
+{
+    char* sCommandLine = new char[strlen(sCommand) + 1];
+    strcpy(sCommandLine, sCommand);
+    char* sPosition = sCommandLine;
+
+    bool bResult = true;
+    ostringstream description;
+    description << "engine " << c_engineVersion << ' ' << NextToken(sPosition);
+
+    unsigned flags = CommandFlags(FindCommand(sCommand));
+    if (flags & c_fileOperand)
+    {
+        char* sOperand = NextToken(sPosition);
+        if (FindCommand(sCommand) == DITHER_PATTERN && FindDitherPattern(sOperand) >= 0)
+            description << ' ' << sOperand;
+        else
+        {
+            CacheKey fileKey = 0;
+            bResult = CResultCache::HashFile(sOperand, fileKey);
+            description << " <" << hex << fileKey << dec << '>';
+        }// else
+    }// if
+    else if (flags & c_fileList)
+    {
+        char* sToken = NextToken(sPosition);
+        if (sToken)
+            description << ' ' << sToken;
+
+        for (sToken = NextToken(sPosition); sToken; sToken = NextToken(sPosition))
+        {
+            CacheKey fileKey = 0;
+            bResult = CResultCache::HashFile(sToken, fileKey) && bResult;
+            description << " <" << hex << fileKey << dec << '>';
+        }// for
+    }// else if
+
+    for (char* sToken = NextToken(sPosition); sToken; sToken = NextToken(sPosition))
+        description << ' ' << sToken;
+
+    delete[] sCommandLine;
+
+    string sDescription = description.str();
+    key = CResultCache::HashBytes(sDescription.data(), sDescription.size(), input);
+    return bResult;
+}// StepKey
+
+
+// a script step whose result was found in the cache, or a deferred load
+struct SPendingStep
+{
+    size_t      step;           // index into the program
+    CacheKey    key;            // key of the step's result
+    bool        bCached;        // the result is in the cache (false for loads)
+};// SPendingStep
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Bring the image up to date with the pending steps.  The newest cached
+//  result is read if it is still there, otherwise the steps are run again
+//  from the current image.  Return false if a step fails.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool Materialize(const vector<string>& vsProgram, vector<SPendingStep>& vPending, TargaImage*& pImage)
+{
+    if (vPending.empty())
+        return true;
+
+    CResultCache& cache = CResultCache::Instance();
+    TargaImage* pCached = vPending.back().bCached ? cache.Load(vPending.back().key) : NULL;
+    if (pCached)
+    {
+        delete pImage;
+        pImage = pCached;
+        vPending.clear();
+        return true;
+    }// if
+
+    bool bResult = true;
+    for (size_t i = 0; i < vPending.size() && bResult; ++i)
+    {
+        bResult = CScriptHandler::HandleCommand(vsProgram[vPending[i].step].c_str(), pImage);
+        if (bResult && vPending[i].bCached && pImage)
+            cache.Store(vPending[i].key, *pImage);
+    }// for
+
+    vPending.clear();
+    return bResult;
+}// Materialize
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -103,21 +463,44 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
     char* sCommandLine = new char[strlen(sCommand) + 1];
     strcpy(sCommandLine, sCommand);
-    char* sToken = strtok(sCommandLine, c_sWhiteSpace);
+    char* sPosition = sCommandLine;
+    char* sToken = NextToken(sPosition);
+    if (!sToken)
+    {
+        delete[] sCommandLine;
+        return true;
+    }// if
 
     // find command that was given
-    int command;
-    for (command = 0; command < NUM_COMMANDS; ++command)
-        if (!strcmp(sToken, c_asCommands[command]))
-            break;
+    int command = FindCommand(sToken);
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != RUN && command != UNDO && command != REDO && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
     }// if
 
+    // proxies are only looked at, and have no history
+    if (s_proxyLevels > 0 && ((CommandFlags(command) & c_observer) || command == UNDO || command == REDO))
+    {
+        delete[] sCommandLine;
+        return true;
+    }// if
+
+    // record what the command changes, scripts record command by command
+    CHistory* pHistory = CHistory::Current();
+    bool bRecorded = pHistory && s_proxyLevels == 0 && !(CommandFlags(command) & c_observer)
+                  && command != RUN && command != UNDO && command != REDO && command != NUM_COMMANDS;
+    if (bRecorded)
+        pHistory->Track(pImage);
+    CHistory::SMark mark = {};
+    if (pHistory && s_proxyLevels == 0)
+        mark = pHistory->Mark();
+
+    // time the command while it runs
+    CProfiler::CCommandScope profile(command < NUM_COMMANDS ? c_asCommands[command] : NULL, pImage);
+
     // handle the command
     bool bResult,
          bParsed = true;
@@ -128,8 +511,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         {
             if (pImage)
                 delete pImage;
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            bResult = (pImage = TargaImage::Load_Image(sFilename)) != NULL;
+            char* sFilename = NextToken(sPosition);
+            bResult = (pImage = Load_Operand(sFilename)) != NULL;
 
             if (!bResult)
             {
@@ -145,7 +528,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case SAVE:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            char* sFilename = NextToken(sPosition);
             if (!sFilename)
                 cout << "No filename given." << endl;
 
@@ -156,10 +539,71 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case RUN:
         {
-            bResult = HandleScriptFile(strtok(NULL, c_sWhiteSpace), pImage);
+            bResult = HandleScriptFile(NextToken(sPosition), pImage);
             break;
         }// RUN
 
+        case MIPMAP:
+        {
+            char* sPrefix = NextToken(sPosition);
+            if (!sPrefix)
+                cout << "No filename prefix given." << endl;
+
+            bParsed = sPrefix != NULL;
+            bResult = bParsed && pImage->Save_Mipmaps(sPrefix);
+            break;
+        }// MIPMAP
+
+        case STATS:
+        {
+            char* sOutput = NextToken(sPosition);
+            bResult = CImageStats(*pImage).Write(sOutput);
+            if (!bResult)
+                cout << "Unable to write statistics:  " << (sOutput ? sOutput : "standard output") << endl;
+            break;
+        }// STATS
+
+        case COMPARE:
+        {
+            char* sFilename = NextToken(sPosition);
+            char* sOutput = NextToken(sPosition);
+            TargaImage* pOther = Load_Operand(sFilename);
+            if (!pOther)
+            {
+                if (sFilename)
+                    cout << "Unable to load image:  " << sFilename << endl;
+                else
+                    cout << "Unable to load image:  " << endl;
+
+                bParsed = bResult = false;
+            }// if
+            else if (pOther->width != pImage->width || pOther->height != pImage->height)
+            {
+                cout << "Compare: Images not the same size" << endl;
+                bResult = false;
+            }// else if
+            else
+            {
+                bResult = CImageStats(*pImage, *pOther).Write(sOutput);
+                if (!bResult)
+                    cout << "Unable to write statistics:  " << (sOutput ? sOutput : "standard output") << endl;
+            }// else
+            delete pOther;
+            break;
+        }// COMPARE
+
+        case UNDO:
+        case REDO:
+        {
+            if (!pHistory)
+                cout << "No history.  Use \"-history\" to keep one." << endl;
+            else if (!(command == UNDO ? pHistory->Undo(pImage) : pHistory->Redo(pImage)))
+                cout << "Nothing to " << c_asCommands[command] << "." << endl;
+
+            bResult = true;
+            break;
+        }// UNDO
+
         case GRAY:
         {
             bResult = pImage->To_Grayscale();
@@ -208,6 +652,41 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DITHER_CLUSTER
         
+        case DITHER_PATTERN:
+        {
+            char* sPattern = NextToken(sPosition);
+            int pattern = FindDitherPattern(sPattern);
+            if (pattern == PATTERN_BAYER)
+            {
+                char* sOrder = NextToken(sPosition);
+                bResult = sOrder && pImage->Dither_Bayer(atoi(sOrder));
+                if (!bResult)
+                {
+                    cout << "Invalid Bayer order." << endl;
+                    bParsed = false;
+                }// if
+            }// if
+            else if (pattern == PATTERN_CLUSTER)
+                bResult = pImage->Dither_Cluster();
+            else
+            {
+                // the tile's pixels are the pattern's, proxies use it full size
+                TargaImage* pTile = Load_Operand(sPattern, 0);
+                if (!pTile)
+                {
+                    if (sPattern)
+                        cout << "Unable to load image:  " << sPattern << endl;
+                    else
+                        cout << "Unable to load image:  " << endl;
+
+                    bParsed = false;
+                }// if
+                bResult = pTile && pImage->Dither_Pattern(pTile);
+                delete pTile;
+            }// else
+            break;
+        }// DITHER_PATTERN
+
         case DITHER_COLOR:
         {
             bResult = pImage->Dither_Color();
@@ -220,6 +699,19 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DITHER_BOX
 
+        case FILTER_BOX_N:
+        {
+            char *sRadius = NextToken(sPosition);
+            if (!sRadius || atoi(sRadius) < 0)
+            {
+                cout << "Invalid filter radius." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Box_N(atoi(sRadius));
+            break;
+        }// FILTER_BOX_N
+
         case FILTER_BARTLETT:
         {
             bResult = pImage->Filter_Bartlett();
@@ -234,7 +726,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case FILTER_GAUSS_N:
         {
-            char *sN = strtok(NULL, c_sWhiteSpace);
+            char *sN = NextToken(sPosition);
             int N = atoi(sN);
             if (N % 2 != 1) {
                cout << "N \"" << N << "\" is not allowed; N must be an odd number." << endl;
@@ -258,7 +750,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case NPR_PAINT:
         {
-            bResult = pImage->NPR_Paint();
+            char *sSeed = NextToken(sPosition);
+            bResult = pImage->NPR_Paint(sSeed ? (unsigned int)strtoul(sSeed, NULL, 10) : 0);
             break;
         }// NPR_PAINT
 
@@ -269,6 +762,21 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// HALF
 
+        case HALF_N:
+        {
+            char *sLevels = NextToken(sPosition);
+            int levels = sLevels ? atoi(sLevels) : 0;
+
+            if (levels < 1)
+            {
+                cout << "Invalid number of halvings." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Half_Size_N(levels);
+            break;
+        }// HALF_N
+
         case DOUBLE:
         {
             bResult = pImage->Double_Size();
@@ -277,23 +785,30 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case SCALE:
         {
-            char *sScale = strtok(NULL, c_sWhiteSpace);
+            char *sScale = NextToken(sPosition);
+            char *sKernel = NextToken(sPosition);
             float scale;
+            int kernel = FindResizeKernel(sKernel);
 
             if (!sScale || !(scale = (float)atof(sScale)) || scale <= 0)
             {
                 cout << "Invalid scaling factor." << endl;
                 bParsed = bResult = false;
             }// if
+            else if (kernel < 0)
+            {
+                cout << "Unknown resampling kernel:  " << sKernel << endl;
+                bParsed = bResult = false;
+            }// else if
             else
-                bResult = pImage->Resize(scale);
+                bResult = pImage->Resize(scale, (TargaImage::EResizeKernel)kernel);
             break;
         }// SCALE
 
         case COMP_OVER:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(sPosition);
+            TargaImage* pNewImage = Load_Operand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -309,8 +824,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case COMP_IN:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(sPosition);
+            TargaImage* pNewImage = Load_Operand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -327,8 +842,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case COMP_OUT:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(sPosition);
+            TargaImage* pNewImage = Load_Operand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -345,8 +860,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case COMP_ATOP:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(sPosition);
+            TargaImage* pNewImage = Load_Operand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -363,8 +878,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case COMP_XOR:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(sPosition);
+            TargaImage* pNewImage = Load_Operand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -379,10 +894,51 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// COMP_XOR
 
+        case COMP_STACK:
+        {
+            char* sOperator = NextToken(sPosition);
+            int op = FindCompositeOp(sOperator);
+            vector<char*> vsFilenames;
+            for (char* sFilename = NextToken(sPosition); sFilename; sFilename = NextToken(sPosition))
+                vsFilenames.push_back(sFilename);
+
+            if (op < 0 || vsFilenames.empty())
+            {
+                if (op < 0)
+                    cout << "Unknown compositing operator:  " << (sOperator ? sOperator : "") << endl;
+                else
+                    cout << "No filename given." << endl;
+                bParsed = bResult = false;
+                break;
+            }// if
+
+            // the layers decode in parallel
+            vector<TargaImage*> vpLayers(vsFilenames.size(), (TargaImage*)NULL);
+            int proxyLevels = s_proxyLevels;
+            CThreadPool::ParallelFor(0, (int)vsFilenames.size(), 1, [&](int first, int last)
+            {
+                for (int layer = first; layer < last; ++layer)
+                    vpLayers[layer] = Load_Operand(vsFilenames[layer], proxyLevels);
+            });
+
+            bResult = true;
+            for (size_t layer = 0; layer < vpLayers.size(); ++layer)
+                if (!vpLayers[layer])
+                {
+                    cout << "Unable to load image:  " << vsFilenames[layer] << endl;
+                    bParsed = bResult = false;
+                }// if
+
+            bResult = bResult && pImage->Comp_Stack((TargaImage::ECompositeOp)op, &vpLayers[0], (int)vpLayers.size());
+            for (size_t layer = 0; layer < vpLayers.size(); ++layer)
+                delete vpLayers[layer];
+            break;
+        }// COMP_STACK
+
         case DIFF:
         {
-            char* sFilename = strtok(NULL, c_sWhiteSpace);
-            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            char* sFilename = NextToken(sPosition);
+            TargaImage* pNewImage = Load_Operand(sFilename);
             if (!pNewImage)
             {
                 if (sFilename)
@@ -399,7 +955,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case ROTATE:
         {
-            char *sAngle = strtok(NULL, c_sWhiteSpace);
+            char *sAngle = NextToken(sPosition);
             float angle;
 
             if (!sAngle || !(angle = (float)atof(sAngle)))
@@ -424,6 +980,18 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
     delete[] sCommandLine;
 
+    // a cancelled command leaves its image half done, scripts must not go on;
+    // the caller throws the image away, so neither may the steps of a script
+    if (CThreadPool::IsCancelled())
+    {
+        if (pHistory && s_proxyLevels == 0)
+            pHistory->Rollback(mark);
+        return false;
+    }// if
+
+    if (bRecorded)
+        pHistory->Record(pImage);
+
     return bParsed;
 }// HandleCommand
 
@@ -436,7 +1004,91 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 //  otherwise false is returned.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage)
+bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage, bool bResultObserved)
+{
+    vector<string> vsCommands;
+    return ReadScriptFile(sFilename, vsCommands) && HandleScript(vsCommands, pImage, bResultObserved);
+}// HandleScriptFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Execute script text, one command per line, on the given image.  Return
+//  as HandleScriptFile.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::HandleScriptText(const char* sScript, TargaImage*& pImage, bool bResultObserved)
+{
+    vector<string> vsCommands;
+    istringstream script(sScript ? sScript : "");
+
+    string sLine;
+    while (getline(script, sLine))
+        vsCommands.push_back(sLine);
+
+    return HandleScript(vsCommands, pImage, bResultObserved);
+}// HandleScriptText
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Execute a list of commands, either one after the other or planned as a
+//  whole when lazy evaluation or the result cache is on.  A recording history
+//  needs every command to run, one after the other.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::HandleScript(const vector<string>& vsCommands, TargaImage*& pImage, bool bResultObserved)
+{
+    if ((!s_bLazy && !CResultCache::Instance().IsEnabled()) || s_proxyLevels > 0 || CHistory::Current())
+    {
+        bool bResult = true;
+        for (size_t i = 0; i < vsCommands.size() && bResult; ++i)
+            bResult = HandleCommand(vsCommands[i].c_str(), pImage);
+
+        return bResult;
+    }// if
+
+    vector<string> vsProgram;
+    if (!ExpandScript(vsCommands, vsProgram, 0))
+        return false;
+
+    vector<bool> vbLive(vsProgram.size(), true);
+    if (s_bLazy)
+        cout << "Lazy evaluation skipped " << PlanLazy(vsProgram, bResultObserved, vbLive) << " of " << vsProgram.size() << " commands." << endl;
+
+    return RunProgram(vsProgram, vbLive, pImage, bResultObserved);
+}// HandleScript
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Turn lazy evaluation of scripts on or off.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptHandler::SetLazyEvaluation(bool bLazy)
+{
+    s_bLazy = bLazy;
+}// SetLazyEvaluation
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Proxy resolution of the calling thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptHandler::SetProxyLevels(int levels)
+{
+    s_proxyLevels = Max(levels, 0);
+}// SetProxyLevels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read the command lines of a script file.  As always, only lines ended 
+//  by a newline are commands.  Return false if the file could not be opened.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::ReadScriptFile(const char* sFilename, vector<string>& vsCommands)
 {
     if (!sFilename)
     {
@@ -452,19 +1104,124 @@ bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage
         return false;
     }// if
 
-    bool bResult = true;
-    char sLine[c_maxLineLength + 1];
-    while (!inFile.eof() && bResult)
+    string sLine;
+    while (getline(inFile, sLine) && !inFile.eof())
+        vsCommands.push_back(sLine);
+
+    inFile.close();
+    return true;
+}// ReadScriptFile
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Flatten a script into a straight-line program by replacing each "run"
+//  command with the commands of the script it names.  Blank lines are dropped.
+//  Return false if a nested script could not be read.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::ExpandScript(const vector<string>& vsCommands, vector<string>& vsProgram, int depth)
+{
+    if (depth > c_maxScriptDepth)
     {
-        inFile.getline(sLine, c_maxLineLength);
+        cout << "Scripts nested too deeply." << endl;
+        return false;
+    }// if
 
-        if (!inFile.eof())
-            bResult = HandleCommand(sLine, pImage);
-    }// while
+    for (size_t i = 0; i < vsCommands.size(); ++i)
+    {
+        const char* sCommand = vsCommands[i].c_str();
+        if (sCommand[strspn(sCommand, c_sWhiteSpace)] == '\0')
+            continue;
 
-    inFile.close();
-    return bResult;
-}// CScriptHandler
+        if (FindCommand(sCommand) != RUN)
+        {
+            vsProgram.push_back(vsCommands[i]);
+            continue;
+        }// if
+
+        char* sCommandLine = new char[vsCommands[i].size() + 1];
+        strcpy(sCommandLine, sCommand);
+        char* sPosition = sCommandLine;
+        NextToken(sPosition);
+
+        vector<string> vsNested;
+        bool bResult = ReadScriptFile(NextToken(sPosition), vsNested) && ExpandScript(vsNested, vsProgram, depth + 1);
+        delete[] sCommandLine;
+
+        if (!bResult)
+            return false;
+    }// for
+
+    return true;
+}// ExpandScript
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the live commands of a straight-line program.  With the result 
+//  cache enabled, every step that transforms the image is keyed by its input
+//  and looked up first.  Cached steps are not run; their results are only
+//  read when a later step misses or observes the image, so a cached prefix of
+//  a script costs a few hashes.  Return as HandleScriptFile.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CScriptHandler::RunProgram(const vector<string>& vsProgram, const vector<bool>& vbLive, TargaImage*& pImage, bool bResultObserved)
+{
+    CResultCache& cache = CResultCache::Instance();
+
+    CacheKey key = 0;                       // key of the current image
+    bool bKeyValid = false;                 // whether key is known
+    vector<SPendingStep> vPending;          // steps not yet applied to pImage
+
+    for (size_t i = 0; i < vsProgram.size(); ++i)
+    {
+        if (!vbLive[i])
+            continue;
+
+        const char* sCommand = vsProgram[i].c_str();
+        unsigned flags = CommandFlags(FindCommand(sCommand));
+        bool bReplaces = (flags & c_replacesImage) != 0;
+        bool bCacheable = cache.IsEnabled() && !(flags & (c_observer | c_barrier | c_uncacheable));
+
+        // the first cacheable step on an existing image needs its hash
+        if (bCacheable && !bReplaces && !bKeyValid && pImage)
+        {
+            key = CResultCache::HashImage(*pImage);
+            bKeyValid = true;
+        }// if
+
+        CacheKey stepKey;
+        if (bCacheable && (bReplaces || bKeyValid) && StepKey(sCommand, bReplaces ? 0 : key, stepKey))
+        {
+            // loads are deferred, cached results are fetched when needed
+            SPendingStep step = { i, stepKey, !bReplaces };
+            if (bReplaces || cache.Contains(stepKey))
+            {
+                vPending.push_back(step);
+                key = stepKey;
+                bKeyValid = true;
+                continue;
+            }// if
+
+            if (!Materialize(vsProgram, vPending, pImage) || !HandleCommand(sCommand, pImage))
+                return false;
+
+            if (pImage)
+                cache.Store(stepKey, *pImage);
+            key = stepKey;
+            bKeyValid = true;
+            continue;
+        }// if
+
+        if (!Materialize(vsProgram, vPending, pImage) || !HandleCommand(sCommand, pImage))
+            return false;
+
+        if (!(flags & c_observer))
+            bKeyValid = false;
+    }// for
 
+    return !bResultObserved || Materialize(vsProgram, vPending, pImage);
+}// RunProgram
 
 
@@ -13,6 +13,9 @@
 #ifndef _C_SCRIPT_HANDLER
 #define _C_SCRIPT_HANDLER
 
+#include <string>
+#include <vector>
+
 class TargaImage;
 
 class CScriptHandler
@@ -28,15 +31,72 @@ class CScriptHandler
         ///////////////////////////////////////////////////////////////////////////////
         static bool HandleCommand(const char* sCommand, TargaImage*& pImage);
 
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Return true if the command only reads the image ("save", "mipmap"),
+        //  so anything derived from the image stays valid after running it.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool IsReadOnlyCommand(const char* sCommand);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Return true if the command changes the image without reading any
+        //  file, so running it on a proxy is quick enough to do at once.  Loads,
+        //  "run" and commands with image file operands decode a full resolution
+        //  file before any shrinking and aren't.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool IsPreviewable(const char* sCommand);
+
         ///////////////////////////////////////////////////////////////////////////////
         //
         //      The given script file is executed on the given image.  If the file is 
         //  not correctly parsed an error message is printed and false is returned.  
         //  Otherwise if all commands in the script execute correctly true is returned,
-        //  otherwise false is returned.
+        //  otherwise false is returned.  bResultObserved tells whether the caller
+        //  will look at the image left behind by the script; lazy evaluation uses it
+        //  to drop trailing commands nobody sees.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool HandleScriptFile(const char* sFilename, TargaImage*& pImage, bool bResultObserved = true);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Execute script text, one command per line, on the given image.  Return
+        //  as HandleScriptFile.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool HandleScriptText(const char* sScript, TargaImage*& pImage, bool bResultObserved = true);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Turn lazy evaluation of scripts on or off.  When on, a script is planned
+        //  as a whole before it runs and only the commands whose results reach a
+        //  "save" (or the caller) are executed.
         //
         ///////////////////////////////////////////////////////////////////////////////
-        static bool HandleScriptFile(const char* sFilename, TargaImage*& pImage);
+        static void SetLazyEvaluation(bool bLazy);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Run the commands of the calling thread on a low resolution proxy:
+        //  every image read from a file is shrunk by levels halvings (Half_Size_N)
+        //  and commands that only read the image ("save") are skipped, so nothing
+        //  is written.  Proxy results are never cached.  0 turns it off.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void SetProxyLevels(int levels);
+
+    private:
+        static bool HandleScript(const std::vector<std::string>& vsCommands, TargaImage*& pImage, bool bResultObserved);
+        static bool ReadScriptFile(const char* sFilename, std::vector<std::string>& vsCommands);
+        static bool ExpandScript(const std::vector<std::string>& vsCommands, std::vector<std::string>& vsProgram, int depth);
+        static bool RunProgram(const std::vector<std::string>& vsProgram, const std::vector<bool>& vbLive, TargaImage*& pImage, bool bResultObserved);
+
+    // members
+    private:
+        static bool s_bLazy;                    // plan scripts and skip dead commands
 };// CScriptHandler
 
 #endif // _C_SCRIPT_HANDLER
@@ -0,0 +1,447 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ScriptServer.cpp
+//
+//      Implementation of CScriptServer methods.  One thread accepts
+//  connections and hands them to a fixed pool of workers, each of which reads
+//  a whole request, runs it and replies.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ScriptServer.h"
+#include "ScriptHandler.h"
+#include "TargaImage.h"
+#include "History.h"
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#ifndef _WIN32
+    #include <errno.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
+
+using namespace std;
+
+// constants
+const char      c_sImageHeader[]        = "IMAGE ";                     // request header naming a resident image
+const char      c_sShutdownHeader[]     = "SHUTDOWN";                   // request header stopping the server
+const char      c_sReplyOK[]            = "OK\n";                       // reply to a successful request
+const char      c_sReplyError[]         = "ERROR\n";                    // reply to a failed request
+
+
+#ifdef _WIN32
+
+void CScriptServer::BlockStopSignals()
+{
+}// BlockStopSignals
+
+int CScriptServer::Serve(const char* sSocketPath, int workers)
+{
+    cout << "Server mode needs Unix domain sockets, which are not supported on this platform." << endl;
+    return 1;
+}// Serve
+
+int CScriptServer::Send(const char* sSocketPath, const char* sImageName, const string& sScript, bool bShutdown)
+{
+    cout << "Client mode needs Unix domain sockets, which are not supported on this platform." << endl;
+    return 1;
+}// Send
+
+#else
+
+// a resident named image, requests using it take turns
+struct SImageSlot
+{
+    SImageSlot() : pImage(NULL) {}
+    ~SImageSlot() { delete pImage; }
+
+    mutex       lock;
+    TargaImage* pImage;
+    unique_ptr<CHistory> pHistory;      // of the image, if the server keeps histories
+};// SImageSlot
+
+// server state shared by the accepting thread and the workers
+static volatile sig_atomic_t                    s_bStopping = 0;
+static mutex                                    s_queueMutex;
+static condition_variable                       s_queueReady;
+static deque<int>                               s_connections;
+static mutex                                    s_slotMutex;
+static map<string, shared_ptr<SImageSlot> >     s_slots;
+static size_t                                   s_historyBudget = 0;    // of each history, 0 for none
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill in a socket address.  Return false if the path is too long.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool MakeAddress(const char* sSocketPath, sockaddr_un& address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(sSocketPath) >= sizeof(address.sun_path))
+    {
+        cout << "Socket path too long:  " << sSocketPath << endl;
+        return false;
+    }// if
+
+    strcpy(address.sun_path, sSocketPath);
+    return true;
+}// MakeAddress
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read from a socket up to end of file.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool ReadAll(int socket, string& sText)
+{
+    char buffer[4096];
+    for (;;)
+    {
+        ssize_t count = read(socket, buffer, sizeof(buffer));
+        if (count == 0)
+            return true;
+        if (count < 0 && errno != EINTR)
+            return false;
+        if (count > 0)
+            sText.append(buffer, count);
+    }// for
+}// ReadAll
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write a whole buffer to a socket.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool WriteAll(int socket, const char* pData, size_t size)
+{
+    while (size)
+    {
+        ssize_t count = write(socket, pData, size);
+        if (count < 0 && errno != EINTR)
+            return false;
+        if (count > 0)
+        {
+            pData += count;
+            size -= count;
+        }// if
+    }// while
+
+    return true;
+}// WriteAll
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Connect to the server socket.  Return the socket, or -1 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Connect(const char* sSocketPath)
+{
+    sockaddr_un address;
+    if (!MakeAddress(sSocketPath, address))
+        return -1;
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server >= 0 && connect(server, (sockaddr*)&address, sizeof(address)))
+    {
+        close(server);
+        server = -1;
+    }// if
+
+    return server;
+}// Connect
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read, run and answer one request.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void HandleRequest(int client, const char* sSocketPath)
+{
+    string sRequest;
+    bool bResult = ReadAll(client, sRequest);
+
+    // headers
+    string sImageName;
+    bool bShutdown = false;
+    size_t start = 0;
+    while (bResult && start < sRequest.size())
+    {
+        size_t end = sRequest.find('\n', start);
+        if (end == string::npos)
+            end = sRequest.size();
+        string sLine = sRequest.substr(start, end - start);
+        if (!sLine.empty() && sLine[sLine.size() - 1] == '\r')
+            sLine.erase(sLine.size() - 1);
+
+        if (!sLine.compare(0, strlen(c_sImageHeader), c_sImageHeader))
+            sImageName = sLine.substr(strlen(c_sImageHeader));
+        else if (sLine == c_sShutdownHeader)
+            bShutdown = true;
+        else
+            break;
+
+        start = end + 1;
+    }// while
+
+    // script, with the history of its image current
+    if (bResult)
+    {
+        string sScript = start < sRequest.size() ? sRequest.substr(start) : string();
+        if (sImageName.empty())
+        {
+            unique_ptr<CHistory> pHistory(s_historyBudget ? new CHistory(s_historyBudget) : NULL);
+            CHistory::SetCurrent(pHistory.get());
+            TargaImage* pImage = NULL;
+            bResult = CScriptHandler::HandleScriptText(sScript.c_str(), pImage, false);
+            delete pImage;
+            CHistory::SetCurrent(NULL);
+        }// if
+        else
+        {
+            shared_ptr<SImageSlot> pSlot;
+            {
+                lock_guard<mutex> lock(s_slotMutex);
+                shared_ptr<SImageSlot>& pNamedSlot = s_slots[sImageName];
+                if (!pNamedSlot)
+                {
+                    pNamedSlot.reset(new SImageSlot);
+                    if (s_historyBudget)
+                        pNamedSlot->pHistory.reset(new CHistory(s_historyBudget));
+                }// if
+                pSlot = pNamedSlot;
+            }
+
+            lock_guard<mutex> lock(pSlot->lock);
+            CHistory::SetCurrent(pSlot->pHistory.get());
+            bResult = CScriptHandler::HandleScriptText(sScript.c_str(), pSlot->pImage, true);
+            CHistory::SetCurrent(NULL);
+        }// else
+    }// if
+
+    const char* sReply = bResult ? c_sReplyOK : c_sReplyError;
+    WriteAll(client, sReply, strlen(sReply));
+    close(client);
+
+    if (bShutdown)
+    {
+        // wake the accepting thread so it sees the flag
+        s_bStopping = 1;
+        int wake = Connect(sSocketPath);
+        if (wake >= 0)
+            close(wake);
+    }// if
+}// HandleRequest
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Worker thread, handle queued connections until the server stops and
+//  the queue is empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Worker(string sSocketPath)
+{
+    for (;;)
+    {
+        int client;
+        {
+            unique_lock<mutex> lock(s_queueMutex);
+            while (s_connections.empty() && !s_bStopping)
+                s_queueReady.wait(lock);
+            if (s_connections.empty())
+                return;
+
+            client = s_connections.front();
+            s_connections.pop_front();
+        }
+
+        HandleRequest(client, sSocketPath.c_str());
+    }// for
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The set of SIGINT and SIGTERM.
+//
+///////////////////////////////////////////////////////////////////////////////
+static sigset_t StopSignals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    return signals;
+}// StopSignals
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Signal thread, wait for SIGINT or SIGTERM, then stop the server and
+//  wake the accepting thread.  Serve sends SIGTERM to this thread itself
+//  when it stops for another reason.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void WaitForStop(string sSocketPath)
+{
+    sigset_t signals = StopSignals();
+    int signal;
+    while (sigwait(&signals, &signal))
+        ;
+
+    if (!s_bStopping)
+    {
+        s_bStopping = 1;
+        int wake = Connect(sSocketPath.c_str());
+        if (wake >= 0)
+            close(wake);
+    }// if
+}// WaitForStop
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Block the stop signals in this thread and the ones it starts.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CScriptServer::BlockStopSignals()
+{
+    sigset_t signals = StopSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}// BlockStopSignals
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Serve requests on the given socket.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CScriptServer::Serve(const char* sSocketPath, int workers)
+{
+    sockaddr_un address;
+    if (!MakeAddress(sSocketPath, address))
+        return 1;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(sSocketPath);
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) || listen(listener, SOMAXCONN))
+    {
+        cout << "Unable to listen on socket:  " << sSocketPath << " (" << strerror(errno) << ")" << endl;
+        if (listener >= 0)
+            close(listener);
+        return 1;
+    }// if
+
+    // -history made a history current on this thread, requests run on the workers
+    if (CHistory::Current())
+        s_historyBudget = Max(CHistory::Current()->MemoryBudget(), (size_t)1);
+
+    // SIGINT and SIGTERM go to the signal thread, in case main didn't block them already
+    BlockStopSignals();
+    signal(SIGPIPE, SIG_IGN);
+    thread signalThread(WaitForStop, string(sSocketPath));
+
+    workers = Max(workers, 1);
+    vector<thread> vWorkers;
+    for (int i = 0; i < workers; ++i)
+        vWorkers.push_back(thread(Worker, string(sSocketPath)));
+
+    cout << "Serving on " << sSocketPath << " with " << workers << " workers." << endl;
+
+    while (!s_bStopping)
+    {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            cout << "Unable to accept connection (" << strerror(errno) << ")" << endl;
+            break;
+        }// if
+
+        if (s_bStopping)
+        {
+            close(client);
+            break;
+        }// if
+
+        lock_guard<mutex> lock(s_queueMutex);
+        s_connections.push_back(client);
+        s_queueReady.notify_one();
+    }// while
+
+    {
+        lock_guard<mutex> lock(s_queueMutex);
+        s_bStopping = 1;
+    }
+    s_queueReady.notify_all();
+    for (int i = 0; i < workers; ++i)
+        vWorkers[i].join();
+
+    pthread_kill(signalThread.native_handle(), SIGTERM);
+    signalThread.join();
+
+    close(listener);
+    unlink(sSocketPath);
+
+    lock_guard<mutex> lock(s_slotMutex);
+    s_slots.clear();
+    return 0;
+}// Serve
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Send a request and print the reply.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CScriptServer::Send(const char* sSocketPath, const char* sImageName, const string& sScript, bool bShutdown)
+{
+    int server = Connect(sSocketPath);
+    if (server < 0)
+    {
+        cout << "Unable to connect to server:  " << sSocketPath << endl;
+        return 1;
+    }// if
+
+    signal(SIGPIPE, SIG_IGN);
+
+    string sRequest;
+    if (sImageName)
+        sRequest += string(c_sImageHeader) + sImageName + "\n";
+    if (bShutdown)
+        sRequest += string(c_sShutdownHeader) + "\n";
+    sRequest += sScript;
+
+    string sReply;
+    bool bSent = WriteAll(server, sRequest.data(), sRequest.size()) && !shutdown(server, SHUT_WR) && ReadAll(server, sReply);
+    close(server);
+
+    if (!bSent)
+    {
+        cout << "Lost connection to server:  " << sSocketPath << endl;
+        return 1;
+    }// if
+
+    cout << sReply;
+    return sReply == c_sReplyOK ? 0 : 1;
+}// Send
+
+#endif // _WIN32
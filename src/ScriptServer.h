@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ScriptServer.h
+//
+//      Long lived script server listening on a Unix domain socket, and the
+//  client that talks to it.  The server keeps named images and the result
+//  cache resident between requests and runs requests concurrently on a pool
+//  of worker threads, so a job pays neither process startup nor cold caches.
+//
+//  A request is plain text sent up to end of file:
+//
+//      IMAGE name          optional, run on the resident image with this name
+//      SHUTDOWN            optional, stop the server after this request
+//      command             script commands, one per line
+//      . . .
+//
+//  The reply is a single line, "OK" or "ERROR".  Requests on the same named
+//  image are serialized; without IMAGE a request starts with no image and its
+//  result is discarded.  Relative file names are resolved against the
+//  server's working directory.  With -history every named image keeps its
+//  own undo history, and a request without IMAGE has one for its script.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SCRIPT_SERVER_H_
+#define _SCRIPT_SERVER_H_
+
+#include <string>
+
+class CScriptServer
+{
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Serve requests on the given socket until a SHUTDOWN request, SIGINT
+        //  or SIGTERM.  workers is the number of requests run at once.  Return the
+        //  process exit code.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static int Serve(const char* sSocketPath, int workers);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Block SIGINT and SIGTERM in the calling thread, and so in every
+        //  thread it starts afterwards.  The server waits for them on a thread of
+        //  its own, which only works if no other thread can take them, so call
+        //  this first thing in main when serving.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void BlockStopSignals();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Send a request to a server.  sImageName may be NULL.  Return the
+        //  process exit code, 0 if the server replied OK.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static int Send(const char* sSocketPath, const char* sImageName, const std::string& sScript, bool bShutdown);
+};// CScriptServer
+
+#endif // _SCRIPT_SERVER_H_
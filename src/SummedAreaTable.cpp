@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SummedAreaTable.cpp
+//
+//      Implementation of CSummedAreaTable methods.  Rows are prefix summed in
+//  parallel, then blocks of columns accumulate down the rows in parallel.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "SummedAreaTable.h"
+#include "TargaImage.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// constants
+const int       c_columnGrain           = 4096;         // table entries per column block task
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructors.
+//
+///////////////////////////////////////////////////////////////////////////////
+CSummedAreaTable::CSummedAreaTable(const TargaImage& image)
+    : m_width(image.width), m_height(image.height), m_channels(4), m_stride(image.width + 1)
+{
+    Build(image.data);
+}// CSummedAreaTable
+
+CSummedAreaTable::CSummedAreaTable(const int* pValues, int width, int height)
+    : m_width(width), m_height(height), m_channels(1), m_stride(width + 1)
+{
+    Build(pValues);
+}// CSummedAreaTable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fill the table from interleaved values.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class Value>
+void CSummedAreaTable::Build(const Value* pValues)
+{
+    size_t row = (size_t)m_stride * m_channels;
+    m_vTable.assign(row * (m_height + 1), 0);
+
+    // running sums along each row
+    CThreadPool::ParallelFor(0, m_height, Max(65536 / Max(m_width, 1), 1), [&](int first, int last)
+    {
+        for (int y = first; y < last; ++y)
+        {
+            const Value* pSource = pValues + (size_t)y * m_width * m_channels;
+            unsigned long long* pTarget = &m_vTable[(y + 1) * row + m_channels];
+            for (int i = 0; i < m_width * m_channels; ++i)
+                pTarget[i] = pTarget[i - m_channels] + (unsigned long long)pSource[i];
+        }// for
+    });
+
+    // then down each column
+    CThreadPool::ParallelFor(0, (int)row, c_columnGrain, [&](int first, int last)
+    {
+        for (int y = 2; y <= m_height; ++y)
+        {
+            unsigned long long* pTarget = &m_vTable[y * row];
+            const unsigned long long* pAbove = pTarget - row;
+            for (int i = first; i < last; ++i)
+                pTarget[i] += pAbove[i];
+        }// for
+    });
+}// Build
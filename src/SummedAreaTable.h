@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SummedAreaTable.h
+//
+//      Summed-area table (integral image).  Entry (x, y) holds the sum of all
+//  values above and to the left of it, so the sum over any rectangle takes
+//  four lookups whatever its size.  Sums are 64 bit, enough for any image
+//  TargaImage can hold.  Tables are built on the thread pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SUMMED_AREA_TABLE_H_
+#define _SUMMED_AREA_TABLE_H_
+
+#include <vector>
+
+class TargaImage;
+
+class CSummedAreaTable
+{
+    // methods
+    public:
+        CSummedAreaTable(const TargaImage& image);                          // one sum per RGBA channel
+        CSummedAreaTable(const int* pValues, int width, int height);        // one channel of non-negative values
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Sum of a channel over the columns [x0, x1) and rows [y0, y1).  The
+        //  rectangle must lie within the table.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        unsigned long long Sum(int x0, int y0, int x1, int y1, int channel = 0) const;
+
+    private:
+        template<class Value>
+        void Build(const Value* pValues);
+
+    // members
+    private:
+        int                             m_width;
+        int                             m_height;
+        int                             m_channels;
+        int                             m_stride;           // entries per row, width + 1
+        std::vector<unsigned long long> m_vTable;           // (width + 1) x (height + 1), first row and column zero
+};// CSummedAreaTable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rectangle sum from the four corners.
+//
+///////////////////////////////////////////////////////////////////////////////
+inline unsigned long long CSummedAreaTable::Sum(int x0, int y0, int x1, int y1, int channel) const
+{
+    const unsigned long long* pTop = &m_vTable[((size_t)y0 * m_stride + x0) * m_channels + channel];
+    const unsigned long long* pBottom = &m_vTable[((size_t)y1 * m_stride + x0) * m_channels + channel];
+    size_t span = (size_t)(x1 - x0) * m_channels;
+    return pBottom[span] - pBottom[0] - pTop[span] + pTop[0];
+}// Sum
+
+#endif // _SUMMED_AREA_TABLE_H_
@@ -12,7 +12,11 @@
 #include "Globals.h"
 #include "TargaImage.h"
 #include "libtarga.h"
+#include "Premultiply.h"
+#include "ThreadPool.h"
+#include "SummedAreaTable.h"
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <memory.h>
 #include <math.h>
@@ -22,6 +26,11 @@
 #include <map>
 #include <algorithm>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define TARGA_SSE2
+    #include <emmintrin.h>
+#endif
+
 using namespace std;
 
 // constants
@@ -29,6 +38,525 @@ const int           RED             = 0;                // red channel
 const int           GREEN           = 1;                // green channel
 const int           BLUE            = 2;                // blue channel
 const unsigned char BACKGROUND[3]   = { 0, 0, 0 };      // background color
+const int           c_grainPixels   = 1 << 16;          // pixels per parallel chunk
+const unsigned long long c_ditherSeed = 0x5DEECE66DULL; // seed of the random dithering noise
+const int           c_weightBits    = 14;               // fraction bits of resampling weights
+const int           c_passShift     = 7;                // fraction bits dropped between resampling passes
+const double        c_piDouble      = 3.14159265358979323846;   // c_pi to double precision, MSVC has no M_PI
+const int           c_rotateTile    = 64;               // side of the tiles rotation walks the output in
+const int           c_rotateBits    = 16;               // fraction bits of rotation source positions
+const unsigned char c_transparent[4] = { 0, 0, 0, 0 };  // stands in for pixels off the image
+const int           c_mipBand       = 64;               // rows of mipmap level 1 built per task
+const unsigned      c_maxHalvings   = 14;               // most Half_Size_N levels, 255 * 16^14 still fits 64 bits
+const int           c_stackTile     = 64;               // side of the tiles a layer stack is composited in
+const int           c_paintRadii[]  = { 7, 3, 1 };      // brush radii of the painterly layers, largest first
+const int           c_paintThreshold = 25;              // mean difference at which a painterly cell gets a stroke
+const unsigned      c_maxBayerOrder = 8;                // largest Bayer matrix, 256 x 256
+const int           c_unpainted     = 1000;             // difference of canvas pixels not yet painted
+const unsigned long long c_paintSeed = 0x2545F4914F6CDD1DULL; // mixed with the seed of the stroke order
+const int           c_spanTableRadius = 32;             // largest brush with a shared span table
+const int           c_paintTile     = 64;               // side of the canvas tiles strokes are binned into
+
+// one row of a painterly brush, see Circle_Spans
+struct SCircleSpan
+{
+    int             half;           // pixels set on each side of the center
+    bool            bEdge;          // average one more pixel past each end
+};
+
+// Porter-Duff operators, see Composite
+typedef TargaImage::ECompositeOp ECompositeOp;
+
+// taps of a separable resampling pass, see Compute_Taps
+struct SResampleTaps
+{
+    int             taps;           // sources read per output
+    vector<int>     vStart;         // first source of each output
+    vector<int>     vWeights;       // taps weights per output
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rows per parallel chunk for an image of the given width.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int RowGrain(int width)
+{
+    return Max(c_grainPixels / Max(width, 1), 1);
+}// RowGrain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Double one RGBA row horizontally with the Bartlett reconstruction
+//  filter: even outputs use taps 2,4,2 and odd outputs 1,3,3,1 around the
+//  source pixel, so every output is the weighted sum over 8.  Edges repeat
+//  the border pixel.  padded must hold width + 3 pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Double_Row(const unsigned char* row, int width, unsigned char* padded, unsigned short* output)
+{
+    memcpy(padded + 4, row, width * 4);
+    memcpy(padded, row, 4);
+    memcpy(padded + (width + 1) * 4, row + (width - 1) * 4, 4);
+    memcpy(padded + (width + 2) * 4, row + (width - 1) * 4, 4);
+
+    for (int x = 0; x < width; x++)
+    {
+        const unsigned char* p = padded + x * 4;        // pixels x - 1 to x + 2
+        unsigned short* even = output + x * 8;
+        for (int c = 0; c < 4; c++)
+        {
+            even[c] = (unsigned short)(2 * p[c] + 4 * p[c + 4] + 2 * p[c + 8]);
+            even[c + 4] = (unsigned short)(p[c] + 3 * p[c + 4] + 3 * p[c + 8] + p[c + 12]);
+        }
+    }
+}// Double_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Resampling kernels, and their radius in source pixels at unit scale.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Kernel_Value(TargaImage::EResizeKernel kernel, double x)
+{
+    x = fabs(x);
+    switch (kernel)
+    {
+        case TargaImage::RESIZE_BOX:
+            return x <= 0.5 ? 1.0 : 0.0;
+
+        case TargaImage::RESIZE_BARTLETT:
+            return x < 1.0 ? 1.0 - x : 0.0;
+
+        case TargaImage::RESIZE_MITCHELL:
+        {
+            // Mitchell-Netravali with B = C = 1/3
+            const double B = 1.0 / 3.0, C = 1.0 / 3.0;
+            if (x < 1.0)
+                return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6;
+            if (x < 2.0)
+                return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6;
+            return 0.0;
+        }// RESIZE_MITCHELL
+
+        case TargaImage::RESIZE_LANCZOS3:
+        {
+            if (x < 1e-8)
+                return 1.0;
+            if (x >= 3.0)
+                return 0.0;
+            double pi_x = c_piDouble * x;
+            return 3 * sin(pi_x) * sin(pi_x / 3) / (pi_x * pi_x);
+        }// RESIZE_LANCZOS3
+    }// switch
+
+    return 0.0;
+}// Kernel_Value
+
+static double Kernel_Radius(TargaImage::EResizeKernel kernel)
+{
+    switch (kernel)
+    {
+        case TargaImage::RESIZE_BOX:        return 0.5;
+        case TargaImage::RESIZE_BARTLETT:   return 1.0;
+        case TargaImage::RESIZE_MITCHELL:   return 2.0;
+        case TargaImage::RESIZE_LANCZOS3:   return 3.0;
+    }// switch
+
+    return 1.0;
+}// Kernel_Radius
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Compute the taps mapping in_size source pixels to out_size outputs.
+//  Each output reads taps consecutive sources from vStart; taps that fall off
+//  the image are folded onto the border pixel.  Weights are fixed point with
+//  c_weightBits fraction bits and sum exactly to one.  When shrinking, the
+//  kernel is stretched by the reduction factor so it also filters.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Compute_Taps(int in_size, int out_size, TargaImage::EResizeKernel kernel, SResampleTaps& taps)
+{
+    double ratio = (double)in_size / out_size;
+    double stretch = Max(ratio, 1.0);
+    double radius = Kernel_Radius(kernel) * stretch;
+
+    taps.taps = Min((int)ceil(2 * radius) + 1, in_size);
+    taps.vStart.resize(out_size);
+    taps.vWeights.assign(out_size * taps.taps, 0);
+
+    vector<double> weights(taps.taps);
+    for (int i = 0; i < out_size; i++)
+    {
+        double center = (i + 0.5) * ratio - 0.5;
+        int first = (int)ceil(center - radius);
+        int last = (int)floor(center + radius);
+        int start = Min(Max(first, 0), in_size - taps.taps);
+
+        fill(weights.begin(), weights.end(), 0.0);
+        double total = 0;
+        for (int p = first; p <= last; p++)
+        {
+            double weight = Kernel_Value(kernel, (p - center) / stretch);
+            weights[Min(Max(p, 0), in_size - 1) - start] += weight;
+            total += weight;
+        }
+
+        // fixed point, any rounding error goes to the largest weight
+        int* fixed = &taps.vWeights[i * taps.taps];
+        int fixed_total = 0, largest = 0;
+        for (int t = 0; t < taps.taps; t++)
+        {
+            fixed[t] = (int)floor(weights[t] / total * (1 << c_weightBits) + 0.5);
+            fixed_total += fixed[t];
+            if (fixed[t] > fixed[largest])
+                largest = t;
+        }
+        fixed[largest] += (1 << c_weightBits) - fixed_total;
+        taps.vStart[i] = start;
+    }
+}// Compute_Taps
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Shrink by a power of two by averaging factor x factor blocks.  Blocks
+//  past the right or bottom edge average the pixels they cover.  Returns the
+//  new pixel buffer.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned char* Box_Reduce(const unsigned char* data, int width, int height, int factor, int out_width, int out_height)
+{
+    unsigned char* output_data = new unsigned char[out_width * out_height * 4];
+    CThreadPool::ParallelFor(0, out_height, RowGrain(out_width), [&](int first, int last)
+    {
+        vector<unsigned> column_sums(width * 4);
+        for (int y = first; y < last; y++)
+        {
+            int row_first = y * factor;
+            int row_last = Min(row_first + factor, height);
+            fill(column_sums.begin(), column_sums.end(), 0u);
+            for (int r = row_first; r < row_last; r++)
+            {
+                const unsigned char* source = data + r * width * 4;
+                for (int k = 0; k < width * 4; k++)
+                    column_sums[k] += source[k];
+            }
+
+            unsigned char* target = output_data + y * out_width * 4;
+            for (int x = 0; x < out_width; x++)
+            {
+                int column_first = x * factor;
+                int column_last = Min(column_first + factor, width);
+                unsigned count = (column_last - column_first) * (row_last - row_first);
+                for (int c = 0; c < 4; c++)
+                {
+                    unsigned sum = 0;
+                    for (int column = column_first; column < column_last; column++)
+                        sum += column_sums[column * 4 + c];
+                    target[x * 4 + c] = (unsigned char)((sum + count / 2) / count);
+                }
+            }
+        }
+    });
+
+    return output_data;
+}// Box_Reduce
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rotate by a whole number of clockwise quarter turns without resampling,
+//  keeping the frame size.  The output is walked in square tiles so the
+//  columns of source a quarter turn reads stay in cache.  Sources that would
+//  sit half a pixel off the grid, when width and height differ by an odd
+//  amount, are rounded down.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Rotate_Quarters(const unsigned char* data, unsigned char* output_data, int width, int height, int turns)
+{
+    // source column and row are x_x * x + x_y * y + x_0 and y_x * x + y_y * y + y_0
+    int x_x = 0, x_y = 0, x_0 = 0, y_x = 0, y_y = 0, y_0 = 0;
+    if (turns == 1)
+    {
+        x_y = 1;    x_0 = (width - height) >> 1;
+        y_x = -1;   y_0 = ((width + height) >> 1) - 1;
+    }// if
+    else if (turns == 2)
+    {
+        x_x = -1;   x_0 = width - 1;
+        y_y = -1;   y_0 = height - 1;
+    }// else if
+    else
+    {
+        x_y = -1;   x_0 = ((width + height) >> 1) - 1;
+        y_x = 1;    y_0 = (height - width) >> 1;
+    }// else
+
+    CThreadPool::ParallelFor(0, (height + c_rotateTile - 1) / c_rotateTile, 1, [&](int first, int last)
+    {
+        for (int band = first; band < last; band++)
+        {
+            int row_first = band * c_rotateTile;
+            int row_last = Min(row_first + c_rotateTile, height);
+            for (int column_first = 0; column_first < width; column_first += c_rotateTile)
+            {
+                int column_last = Min(column_first + c_rotateTile, width);
+                for (int y = row_first; y < row_last; y++)
+                {
+                    unsigned char* target = output_data + (y * width + column_first) * 4;
+                    int source_x = x_x * column_first + x_y * y + x_0;
+                    int source_y = y_x * column_first + y_y * y + y_0;
+                    for (int x = column_first; x < column_last; x++, target += 4, source_x += x_x, source_y += y_x)
+                    {
+                        if (source_x >= 0 && source_x < width && source_y >= 0 && source_y < height)
+                            memcpy(target, data + (source_y * width + source_x) * 4, 4);
+                        else
+                            memset(target, 0, 4);
+                    }// for
+                }// for
+            }// for
+        }// for
+    });
+}// Rotate_Quarters
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rotate clockwise by radians with inverse mapping.  Each output row of
+//  a tile steps its source position by a constant in fixed point, and the
+//  four neighbours are blended with 8 bit weights.  Neighbours off the image
+//  count as transparent, which antialiases the rotated edges.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Rotate_Bilinear(const unsigned char* data, unsigned char* output_data, int width, int height, double radians)
+{
+    const double cosine = cos(radians), sine = sin(radians);
+    const double center_x = width * 0.5, center_y = height * 0.5;
+    const long long one = 1LL << c_rotateBits;
+    const long long step_x = llround(cosine * one), step_y = llround(-sine * one);
+
+    CThreadPool::ParallelFor(0, (height + c_rotateTile - 1) / c_rotateTile, 1, [&](int first, int last)
+    {
+        for (int band = first; band < last; band++)
+        {
+            int row_first = band * c_rotateTile;
+            int row_last = Min(row_first + c_rotateTile, height);
+            for (int column_first = 0; column_first < width; column_first += c_rotateTile)
+            {
+                int column_last = Min(column_first + c_rotateTile, width);
+                for (int y = row_first; y < row_last; y++)
+                {
+                    // source position of the pixel center, less half a pixel so the
+                    // integer part is the top left neighbour
+                    double dx = column_first + 0.5 - center_x, dy = y + 0.5 - center_y;
+                    long long source_x = llround((cosine * dx + sine * dy + center_x - 0.5) * one);
+                    long long source_y = llround((-sine * dx + cosine * dy + center_y - 0.5) * one);
+
+                    unsigned char* target = output_data + (y * width + column_first) * 4;
+                    for (int x = column_first; x < column_last; x++, target += 4, source_x += step_x, source_y += step_y)
+                    {
+                        int left = (int)(source_x >> c_rotateBits), top = (int)(source_y >> c_rotateBits);
+                        int fraction_x = (int)(source_x >> (c_rotateBits - 8)) & 255;
+                        int fraction_y = (int)(source_y >> (c_rotateBits - 8)) & 255;
+                        int weights[4] = { (256 - fraction_x) * (256 - fraction_y), fraction_x * (256 - fraction_y),
+                                           (256 - fraction_x) * fraction_y, fraction_x * fraction_y };
+
+                        if (left < -1 || left >= width || top < -1 || top >= height)
+                        {
+                            memset(target, 0, 4);
+                            continue;
+                        }// if
+
+                        const unsigned char* neighbours[4];
+                        if (left >= 0 && left + 1 < width && top >= 0 && top + 1 < height)
+                        {
+                            neighbours[0] = data + (top * width + left) * 4;
+                            neighbours[1] = neighbours[0] + 4;
+                            neighbours[2] = neighbours[0] + width * 4;
+                            neighbours[3] = neighbours[2] + 4;
+                        }// if
+                        else
+                        {
+                            for (int n = 0; n < 4; n++)
+                            {
+                                int column = left + (n & 1), row = top + (n >> 1);
+                                neighbours[n] = (column >= 0 && column < width && row >= 0 && row < height)
+                                              ? data + (row * width + column) * 4 : c_transparent;
+                            }// for
+                        }// else
+
+                        for (int c = 0; c < 4; c++)
+                            target[c] = (unsigned char)((weights[0] * neighbours[0][c] + weights[1] * neighbours[1][c]
+                                                       + weights[2] * neighbours[2][c] + weights[3] * neighbours[3][c] + 32768) >> 16);
+                    }// for
+                }// for
+            }// for
+        }// for
+    });
+}// Rotate_Bilinear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter and decimate by 2^levels.  Output pixel i sits over source
+//  pixel i * 2^levels; each output row sums its window of source rows with
+//  the kernel into a column buffer, then filters just the columns it keeps.
+//  Accumulator must hold 255 * 16^levels.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class Accumulator>
+static void Half_Rows(const unsigned char* data, unsigned char* output_data, int width, int height, unsigned levels,
+                      const vector<int>& kernel)
+{
+    int out_width = width >> levels, out_height = height >> levels;
+    int taps = (int)kernel.size(), reach = (taps - 1) / 2;
+    int shift = 4 * levels;
+
+    CThreadPool::ParallelFor(0, out_height, Max(RowGrain(out_width) >> levels, 1), [&](int first, int last)
+    {
+        vector<Accumulator> columns(width * 4);
+        for (int y = first; y < last; y++)
+        {
+            // vertical pass over the row window
+            fill(columns.begin(), columns.end(), 0);
+            for (int t = 0; t < taps; t++)
+            {
+                int row = Min(Max((y << levels) - reach + t, 0), height - 1);
+                const unsigned char* source = data + row * width * 4;
+                Accumulator weight = kernel[t];
+                for (int k = 0; k < width * 4; k++)
+                    columns[k] += weight * source[k];
+            }// for
+
+            // horizontal pass at the kept columns
+            unsigned char* target = output_data + y * out_width * 4;
+            for (int x = 0; x < out_width; x++, target += 4)
+            {
+                Accumulator sum[4] = { 0, 0, 0, 0 };
+                for (int t = 0; t < taps; t++)
+                {
+                    int column = Min(Max((x << levels) - reach + t, 0), width - 1);
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += kernel[t] * columns[column * 4 + c];
+                }// for
+                for (int c = 0; c < 4; c++)
+                    target[c] = (unsigned char)((sum[c] + ((Accumulator)1 << (shift - 1))) >> shift);
+            }// for
+        }// for
+    });
+}// Half_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Compute row y of a mipmap level from the level above it with the 1 2 1
+//  filter of Half_Size.  Sizes of one are not halved again; clamping makes
+//  the filter an identity along such an axis.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Mip_Row(const TargaImage& source, TargaImage& target, int y)
+{
+    int rows[3] = { Max(2 * y - 1, 0), Min(2 * y, source.height - 1), Min(2 * y + 1, source.height - 1) };
+    const unsigned char* above = source.data + rows[0] * source.width * 4;
+    const unsigned char* middle = source.data + rows[1] * source.width * 4;
+    const unsigned char* below = source.data + rows[2] * source.width * 4;
+    unsigned char* output = target.data + y * target.width * 4;
+
+    for (int x = 0; x < target.width; x++, output += 4)
+    {
+        int columns[3] = { Max(2 * x - 1, 0) * 4, Min(2 * x, source.width - 1) * 4, Min(2 * x + 1, source.width - 1) * 4 };
+        for (int c = 0; c < 4; c++)
+        {
+            int left = above[columns[0] + c] + 2 * middle[columns[0] + c] + below[columns[0] + c];
+            int center = above[columns[1] + c] + 2 * middle[columns[1] + c] + below[columns[1] + c];
+            int right = above[columns[2] + c] + 2 * middle[columns[2] + c] + below[columns[2] + c];
+            output[c] = (unsigned char)((left + 2 * center + right + 8) >> 4);
+        }// for
+    }// for
+}// Mip_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Spans of the painterly brush, one per row offset from -radius to
+//  radius.  Tables for radii up to c_spanTableRadius are built once and
+//  shared; larger ones are built into vLocalSpans on each call.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Build_Circle_Spans(int radius, vector<SCircleSpan>& vSpans)
+{
+    vSpans.resize(2 * radius + 1);
+    for (int y_off = -radius; y_off <= radius; y_off++)
+    {
+        SCircleSpan& span = vSpans[y_off + radius];
+        int remaining = radius * radius - y_off * y_off;
+        span.half = (int)sqrt((double)remaining);
+        while (span.half * span.half > remaining)
+            span.half--;
+        while ((span.half + 1) * (span.half + 1) <= remaining)
+            span.half++;
+
+        // the averaged ring, only where the brush's bounding square reaches
+        span.bEdge = span.half + 1 <= radius && (span.half + 1) * (span.half + 1) == remaining + 1;
+    }// for
+}// Build_Circle_Spans
+
+static const vector<SCircleSpan>& Circle_Spans(unsigned int radius, vector<SCircleSpan>& vLocalSpans)
+{
+    static const vector<vector<SCircleSpan> > s_vvTables = []()
+    {
+        vector<vector<SCircleSpan> > vvTables(c_spanTableRadius + 1);
+        for (int r = 0; r <= c_spanTableRadius; r++)
+            Build_Circle_Spans(r, vvTables[r]);
+        return vvTables;
+    }();
+
+    if (radius <= (unsigned)c_spanTableRadius)
+        return s_vvTables[radius];
+
+    Build_Circle_Spans((int)radius, vLocalSpans);
+    return vLocalSpans;
+}// Circle_Spans
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set count pixels to one color, four at a time where SSE2 is available.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline void Fill_Span(unsigned char* target, const unsigned char color[4], int count)
+{
+    int i = 0;
+#ifdef TARGA_SSE2
+    int pattern;
+    memcpy(&pattern, color, 4);
+    const __m128i pixels = _mm_set1_epi32(pattern);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(target + i * 4), pixels);
+#endif
+    for (; i < count; i++)
+        memcpy(target + i * 4, color, 4);
+}// Fill_Span
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Small counter based generator (splitmix64) so every row of noise can
+//  be produced independently of the others.
+//
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned long long NextRandom(unsigned long long& state)
+{
+    unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}// NextRandom
 
 
 // Computes n choose s, efficiently
@@ -120,28 +648,35 @@ TargaImage::~TargaImage()
 ///////////////////////////////////////////////////////////////////////////////
 unsigned char* TargaImage::To_RGB(void)
 {
-    unsigned char   *rgb = new unsigned char[width * height * 3];
-    int		    i, j;
-
     if (! data)
 	    return NULL;
 
+    unsigned char   *rgb = new unsigned char[width * height * 3];
+
     // Divide out the alpha
-    for (i = 0 ; i < height ; i++)
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
     {
-	    int in_offset = i * width * 4;
-	    int out_offset = i * width * 3;
-
-	    for (j = 0 ; j < width ; j++)
-        {
-	        RGBA_To_RGB(data + (in_offset + j*4), rgb + (out_offset + j*3));
-	    }
-    }
+        for (int i = first ; i < last ; i++)
+            alpha_display_row(data + i * width * 4, rgb + i * width * 3, width, BACKGROUND);
+    });
 
     return rgb;
 }// TargaImage
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the rectangle at (x, y) of size w x h to RGB, as To_RGB does,
+//  into rgb.  The rectangle must lie inside the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::To_RGB(int x, int y, int w, int h, unsigned char* rgb)
+{
+    for (int i = 0; i < h; i++)
+        alpha_display_row(data + ((y + i) * width + x) * 4, rgb + i * w * 3, w, BACKGROUND);
+}// To_RGB
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Save the image to a targa file. Returns 1 on success, 0 on failure.
@@ -156,7 +691,8 @@ bool TargaImage::Save_Image(const char *filename)
 
     if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
     {
-	    cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
+	    cout << "TGA Save Error: " << tga_error_string(tga_get_last_error()) << endl;
+	    delete out_image;
 	    return false;
     }
 
@@ -188,7 +724,10 @@ TargaImage* TargaImage::Load_Image(char *filename)
     temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
     if (!temp_data)
     {
-        cout << "TGA Error: %s\n", tga_error_string(tga_get_last_error());
+        // comp-stack loads its layers in parallel, so the line is written whole
+        ostringstream message;
+        message << "TGA Error: " << filename << ":  " << tga_error_string(tga_get_last_error()) << '\n';
+        cout << message.str() << flush;
 	    width = height = 0;
 	    return NULL;
     }
@@ -212,12 +751,15 @@ TargaImage* TargaImage::Load_Image(char *filename)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::To_Grayscale()
 {   
-    for (int i = 0; i < (width * height * 4); i = i + 4)//looping by height
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
     {
+        for (int i = first * width * 4; i < last * width * 4; i = i + 4)//looping by pixel
+        {
             data[i] = data[i] * 0.299 + data[i + 1] * 0.587 + data[i + 2] * 0.114;//grayscale formula
             data[i + 1] = data[i];//passing the value to green
-            data[i + 2] = data[i];//passing the value to 
-    }
+            data[i + 2] = data[i];//passing the value to blue
+        }
+    });
 	return true;
 }// To_Grayscale
 
@@ -232,17 +774,20 @@ bool TargaImage::Quant_Uniform()
 {
     unsigned char bits_per_channel = 8;//total bits per channel
     unsigned char red_bits = 3; unsigned char green_bits = 3; unsigned char blue_bits = 2;//bits allocated per color channel
-    for (int i = 0; i < height; i++)//looping by height
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
     {
-        int offset = i * width * 4;//offset to point to the height in data
-        for (int j = 0; j < width; j++)//looping by width
+        for (int i = first; i < last; i++)//looping by height
         {
-            int current_pixel = offset + j * 4;//point to start of current pixel in data
-            data[current_pixel] = data[current_pixel] >> (bits_per_channel-red_bits) << (bits_per_channel - red_bits);
-            data[current_pixel + 1] = data[current_pixel + 1] >> (bits_per_channel - green_bits) << (bits_per_channel - green_bits);
-            data[current_pixel + 2] = data[current_pixel + 2] >> (bits_per_channel - blue_bits) << (bits_per_channel - blue_bits);
+            int offset = i * width * 4;//offset to point to the height in data
+            for (int j = 0; j < width; j++)//looping by width
+            {
+                int current_pixel = offset + j * 4;//point to start of current pixel in data
+                data[current_pixel] = data[current_pixel] >> (bits_per_channel-red_bits) << (bits_per_channel - red_bits);
+                data[current_pixel + 1] = data[current_pixel + 1] >> (bits_per_channel - green_bits) << (bits_per_channel - green_bits);
+                data[current_pixel + 2] = data[current_pixel + 2] >> (bits_per_channel - blue_bits) << (bits_per_channel - blue_bits);
+            }
         }
-    }
+    });
     return true;
 }// Quant_Uniform
 
@@ -338,25 +883,18 @@ bool TargaImage::Quant_Populosity()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Threshold()
 {   
-    float* temp = new float[4 * height * width];//create a temporary dynamic array in memory to store the intensity
     To_Grayscale();
-    for (int i = 0; i < (width * height * 4); i = i + 4)//loop through the image
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
     {
-        temp[i] = data[i] / (float)256;//intensity range set to [0.0, 1.0]
-        if (temp[i] > 0.5)//if threshold is passed set to white, otherwise black
-        {
-            data[i] = 255;
-            data[i + 1] = 255;
-            data[i + 2] = 255;
-        }
-        else
+        for (int i = first * width * 4; i < last * width * 4; i = i + 4)//loop through the image
         {
-            data[i] = 0;
-            data[i + 1] = 0;
-            data[i + 2] = 0;
+            // intensity / 256 > 0.5, exactly
+            unsigned char value = data[i] > 128 ? 255 : 0;//if threshold is passed set to white, otherwise black
+            data[i] = value;
+            data[i + 1] = value;
+            data[i + 2] = value;
         }
-    }
-    delete[] temp;//erase the temporary array
+    });
     return true;
 }// Dither_Threshold
 
@@ -369,47 +907,24 @@ bool TargaImage::Dither_Threshold()
 //Random number reference: https://en.cppreference.com/w/cpp/numeric/random
 bool TargaImage::Dither_Random()
 {
-    float* temp = new float[4 * height * width];//create a temporary dynamic array in memory to store the intensity
     To_Grayscale();
-    for (int i = 0; i < (width * height * 4); i = i + 4)//adding random value to intensity
-    {
-        int random = (rand() % 103) -51;//[0, 102] -> [-51, 51] == [-0.2, 0.2]
-        if ((data[i] + random) < 0)
-        {
-            data[i] = 0;
-            data[i + 1] = 0;
-            data[i + 2] = 0;
-        }
-        else if ((data[i] + random) > 255)
-        {
-            data[i] = 255;
-            data[i + 1] = 255;
-            data[i + 2] = 255;
-        }
-        else
-        {
-            data[i] = data[i] + random;
-            data[i + 1] = data[i + 1] + random;
-            data[i + 2] = data[i + 2] + random;
-        }
-    }
-    for (int i = 0; i < (width * height * 4); i = i + 4)//loop through the image
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
     {
-        temp[i] = data[i] / (float)256;//intensity range set to [0.0, 1.0]
-        if (temp[i] > 0.5)//if threshold is passed set to white, otherwise black
-        {
-            data[i] = 255;
-            data[i + 1] = 255;
-            data[i + 2] = 255;
-        }
-        else
+        for (int row = first; row < last; row++)
         {
-            data[i] = 0;
-            data[i + 1] = 0;
-            data[i + 2] = 0;
+            // every row has its own noise, so the result doesn't depend on the threads
+            unsigned long long state = c_ditherSeed ^ ((unsigned long long)row << 32);
+            NextRandom(state);
+            for (int i = row * width * 4; i < (row + 1) * width * 4; i = i + 4)
+            {
+                int random = (int)(NextRandom(state) % 103) - 51;//[0, 102] -> [-51, 51] == [-0.2, 0.2]
+                unsigned char value = data[i] + random > 128 ? 255 : 0;//if threshold is passed set to white, otherwise black
+                data[i] = value;
+                data[i + 1] = value;
+                data[i + 2] = value;
+            }
         }
-    }
-    delete[] temp;//erase the temporary array
+    });
     return true;
 }// Dither_Random
 
@@ -545,6 +1060,22 @@ bool TargaImage::Dither_Bright()
 }// Dither_Bright
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The largest byte value v with v / 256 not above a threshold in [0, 1],
+//  in float as the dithering compared them, so a byte exceeds the result
+//  exactly when its intensity exceeded the threshold.
+//
+///////////////////////////////////////////////////////////////////////////////
+static unsigned char Byte_Threshold(float threshold)
+{
+    int value = 0;
+    while (value < 255 && !((value + 1) / (float)256 > threshold))
+        value++;
+    return (unsigned char)value;
+}// Byte_Threshold
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Perform clustered differing of the image.  Return success of operation.
@@ -556,64 +1087,157 @@ bool TargaImage::Dither_Cluster()
                             {0.0588, 0.9412, 0.8235, 0.4118},
                             { 0.4706, 0.7647, 0.8824, 0.1176},
                             {0.1765, 0.5294,  0.2941, 0.6471} };//Array of cluster thresholds
-    float* temp = new float[4 * height * width];//create a temporary dynamic array in memory to store the intensity
-    To_Grayscale();
-    for (int i = 0; i < (width * height * 4); i = i + 4)//loop through the image
-    {
-        temp[i] = data[i] / (float)256;//intensity range set to [0.0, 1.0]
-        temp[i + 1] = data[i + 1] / (float)256;
-        temp[i + 2] = data[i + 2] / (float)256;
-    }
-    for (int i = 0; i < height; i++)
-    {
-        for (int j = 0; j < width; j++)
-        {
-            int pixel = (i * width * 4) + (j * 4);
-            if (temp[pixel] > cluster[j%4][i%4])//if threshold is passed set to white, otherwise black
-            {
-                data[pixel] = 255;
-                data[pixel + 1] = 255;
-                data[pixel + 2] = 255;
-            }
-            else
-            {
-                data[pixel] = 0;
-                data[pixel + 1] = 0;
-                data[pixel + 2] = 0;
-            }
-        }
-    }
-    delete[] temp;//erase the temporary array
-    return true;
+
+    // pixel (x, y) was compared against cluster[x % 4][y % 4], so the tile is the matrix transposed
+    unsigned char thresholds[4][4];
+    for (int y = 0; y < 4; y++)
+        for (int x = 0; x < 4; x++)
+            thresholds[y][x] = Byte_Threshold(cluster[x][y]);
+    return Dither_Ordered(&thresholds[0][0], 4, 4);
 }// Dither_Cluster
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//  Convert the image to an 8 bit image using Floyd-Steinberg dithering over
-//  a uniform quantization - the same quantization as in Quant_Uniform.
-//  Return success of operation.
+//      Ordered dithering with a Bayer matrix of side 2^order, 1 to
+//  c_maxBayerOrder.  The matrix doubles from [0] by
+//      M' = | 4M     4M + 2 |
+//           | 4M + 3 4M + 1 |
+//  and its n^2 entries become thresholds at the centers of n^2 equal steps
+//  of the byte range.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Color()
+bool TargaImage::Dither_Bayer(unsigned int order)
 {
-    float old_red, old_green, old_blue, new_red, new_green, new_blue;//temp variables to store pixel intensity
-    float quant_error_red, quant_error_green, quant_error_blue;//quantitation error
-    float red_palette[8] = {0.0, 0.140625, 0.28515625, 0.42578125, 0.5703125, 0.7109375, 0.85546875, 1.0};//color palettes for rgb is declared ranges from 0 to 1 and 0 to 255
-    unsigned char red_table[8] = { 0, 36, 73, 109, 146, 182, 219, 255 };
-    float green_palette[8] = { 0.0, 0.140625, 0.28515625, 0.42578125, 0.5703125, 0.7109375, 0.85546875, 1.0 };
-    unsigned char green_table[8] = { 0, 36, 73, 109, 146, 182, 219, 255 };
-    float blue_palette[4] = { 0, 0.33203125, 0.6640625, 1 };
-    unsigned char blue_table[4] = { 0, 85, 170, 255 };
-    unsigned char* rgb = new unsigned char[3 * height * width];
-    float* I = new float[3 * height * width];//create a temporary dynamic array in memory to store the intensity of the rgb;
-    int iterator;//rgb iterator
-    rgb = To_RGB();
-    for (int i = 0; i < (width * height * 3); i++)//adding random value to intensity
+    if (order < 1 || order > c_maxBayerOrder)
+        return false;
+
+    static const int offsets[2][2] = { { 0, 2 }, { 3, 1 } };
+    int size = 1 << order;
+    vector<int> matrix(1, 0);
+    for (int n = 1; n < size; n *= 2)
     {
-        I[i] = rgb[i] / (float)256;//intensity range set to [0.0, 1.0];
-    }
-    for (int i = 0; i < height; i++) 
+        vector<int> doubled(4 * n * n);
+        for (int y = 0; y < 2 * n; y++)
+            for (int x = 0; x < 2 * n; x++)
+                doubled[y * 2 * n + x] = 4 * matrix[(y % n) * n + x % n] + offsets[y / n][x / n];
+        matrix.swap(doubled);
+    }// for
+
+    vector<unsigned char> thresholds(size * size);
+    for (int i = 0; i < size * size; i++)
+        thresholds[i] = (unsigned char)((2 * matrix[i] + 1) * 255 / (2 * size * size));
+    return Dither_Ordered(&thresholds[0], size, size);
+}// Dither_Bayer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Ordered dithering with the gray values of an image as the threshold
+//  tile, such as a blue noise texture.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Pattern(const TargaImage* pTile)
+{
+    if (!pTile || !pTile->data)
+        return false;
+
+    TargaImage gray(*pTile);
+    gray.To_Grayscale();
+    vector<unsigned char> thresholds(gray.width * gray.height);
+    for (int i = 0; i < gray.width * gray.height; i++)
+        thresholds[i] = gray.data[i * 4];
+    return Dither_Ordered(&thresholds[0], gray.width, gray.height);
+}// Dither_Pattern
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Ordered dithering against a tile of byte thresholds repeated over the
+//  image: a pixel turns white where its gray value exceeds the threshold
+//  over it, black elsewhere.  Every tile row is first repeated across the
+//  image width, so image rows are compared with a plain byte row, sixteen
+//  pixels per compare where SSE2 is available.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Ordered(const unsigned char* thresholds, int tileWidth, int tileHeight)
+{
+    if (!data || !thresholds || tileWidth <= 0 || tileHeight <= 0)
+        return false;
+
+    To_Grayscale();
+    vector<unsigned char> rows((size_t)tileHeight * width);
+    for (int y = 0; y < tileHeight; y++)
+        for (int x = 0; x < width; x++)
+            rows[(size_t)y * width + x] = thresholds[y * tileWidth + x % tileWidth];
+
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
+    {
+        for (int y = first; y < last; y++)
+        {
+            unsigned char* pixel = data + (size_t)y * width * 4;
+            const unsigned char* threshold = &rows[(size_t)(y % tileHeight) * width];
+            int x = 0;
+#ifdef TARGA_SSE2
+            const __m128i low = _mm_set1_epi32(0xFF);
+            const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+            const __m128i sign = _mm_set1_epi8((char)0x80);
+            for (; x + 16 <= width; x += 16)
+            {
+                __m128i* block = (__m128i*)(pixel + x * 4);
+                __m128i p0 = _mm_loadu_si128(block), p1 = _mm_loadu_si128(block + 1);
+                __m128i p2 = _mm_loadu_si128(block + 2), p3 = _mm_loadu_si128(block + 3);
+                __m128i gray = _mm_packus_epi16(_mm_packs_epi32(_mm_and_si128(p0, low), _mm_and_si128(p1, low)),
+                                                _mm_packs_epi32(_mm_and_si128(p2, low), _mm_and_si128(p3, low)));
+                __m128i white = _mm_cmpgt_epi8(_mm_xor_si128(gray, sign), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(threshold + x)), sign));
+
+                // spread each byte of the mask over the color channels of its pixel
+                __m128i low8 = _mm_unpacklo_epi8(white, white), high8 = _mm_unpackhi_epi8(white, white);
+                _mm_storeu_si128(block, _mm_or_si128(_mm_and_si128(p0, alpha), _mm_andnot_si128(alpha, _mm_unpacklo_epi16(low8, low8))));
+                _mm_storeu_si128(block + 1, _mm_or_si128(_mm_and_si128(p1, alpha), _mm_andnot_si128(alpha, _mm_unpackhi_epi16(low8, low8))));
+                _mm_storeu_si128(block + 2, _mm_or_si128(_mm_and_si128(p2, alpha), _mm_andnot_si128(alpha, _mm_unpacklo_epi16(high8, high8))));
+                _mm_storeu_si128(block + 3, _mm_or_si128(_mm_and_si128(p3, alpha), _mm_andnot_si128(alpha, _mm_unpackhi_epi16(high8, high8))));
+            }// for
+#endif
+            for (; x < width; x++)
+            {
+                unsigned char value = pixel[x * 4] > threshold[x] ? 255 : 0;
+                pixel[x * 4] = value;
+                pixel[x * 4 + 1] = value;
+                pixel[x * 4 + 2] = value;
+            }// for
+        }// for
+    });
+    return true;
+}// Dither_Ordered
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//  Convert the image to an 8 bit image using Floyd-Steinberg dithering over
+//  a uniform quantization - the same quantization as in Quant_Uniform.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Color()
+{
+    float old_red, old_green, old_blue, new_red, new_green, new_blue;//temp variables to store pixel intensity
+    float quant_error_red, quant_error_green, quant_error_blue;//quantitation error
+    float red_palette[8] = {0.0, 0.140625, 0.28515625, 0.42578125, 0.5703125, 0.7109375, 0.85546875, 1.0};//color palettes for rgb is declared ranges from 0 to 1 and 0 to 255
+    unsigned char red_table[8] = { 0, 36, 73, 109, 146, 182, 219, 255 };
+    float green_palette[8] = { 0.0, 0.140625, 0.28515625, 0.42578125, 0.5703125, 0.7109375, 0.85546875, 1.0 };
+    unsigned char green_table[8] = { 0, 36, 73, 109, 146, 182, 219, 255 };
+    float blue_palette[4] = { 0, 0.33203125, 0.6640625, 1 };
+    unsigned char blue_table[4] = { 0, 85, 170, 255 };
+    unsigned char* rgb = new unsigned char[3 * height * width];
+    float* I = new float[3 * height * width];//create a temporary dynamic array in memory to store the intensity of the rgb;
+    int iterator;//rgb iterator
+    rgb = To_RGB();
+    for (int i = 0; i < (width * height * 3); i++)//adding random value to intensity
+    {
+        I[i] = rgb[i] / (float)256;//intensity range set to [0.0, 1.0];
+    }
+    for (int i = 0; i < height; i++) 
     {
         for (int j = 0; j < width * 3; j += 3) 
         {
@@ -702,6 +1326,156 @@ bool TargaImage::Dither_Color()
 }// Dither_Color
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Porter-Duff compositing of premultiplied images.  The result is
+//  A * Fa + B * Fb, with A the current image, B the given one and the
+//  factors below (in 0..255), rounded exactly to nearest after the division
+//  by 255.  Fa + Fb never exceeds 255 with premultiplied inputs, so the
+//  blend fits in 16 bits, which lets the SSE2 path work on eight channels at
+//  a time.  The operator is a template argument and its factor selection
+//  folds away at compile time.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<ECompositeOp op>
+static inline int Factor_A(int alpha_b)
+{
+    return op == TargaImage::COMPOSITE_OVER ? 255 : (op == TargaImage::COMPOSITE_IN || op == TargaImage::COMPOSITE_ATOP) ? alpha_b : 255 - alpha_b;
+}// Factor_A
+
+template<ECompositeOp op>
+static inline int Factor_B(int alpha_a)
+{
+    return (op == TargaImage::COMPOSITE_IN || op == TargaImage::COMPOSITE_OUT) ? 0 : 255 - alpha_a;
+}// Factor_B
+
+static inline int Divide_255(int value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}// Divide_255
+
+#ifdef TARGA_SSE2
+template<ECompositeOp op>
+static inline __m128i Composite_Pair(__m128i a, __m128i b)
+{
+    // a and b hold two pixels as 16 bit channels
+    const __m128i full = _mm_set1_epi16(255);
+    __m128i alpha_a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i alpha_b = _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+    __m128i factor_a = op == TargaImage::COMPOSITE_OVER ? full : (op == TargaImage::COMPOSITE_IN || op == TargaImage::COMPOSITE_ATOP) ? alpha_b : _mm_sub_epi16(full, alpha_b);
+    __m128i sum = _mm_mullo_epi16(a, factor_a);
+    if (op != TargaImage::COMPOSITE_IN && op != TargaImage::COMPOSITE_OUT)
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_sub_epi16(full, alpha_a)));
+
+    sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_srli_epi16(sum, 8)), 8);
+}// Composite_Pair
+#endif
+
+template<ECompositeOp op>
+static void Composite_Span(unsigned char* data, const unsigned char* other, int pixels)
+{
+    int i = 0, end = pixels * 4;
+
+#ifdef TARGA_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(other + i));
+        __m128i low = Composite_Pair<op>(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i high = Composite_Pair<op>(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_packus_epi16(low, high));
+    }// for
+#endif
+
+    for (; i < end; i += 4)
+    {
+        int factor_a = Factor_A<op>(other[i + 3]), factor_b = Factor_B<op>(data[i + 3]);
+        for (int c = 0; c < 4; c++)
+            data[i + c] = (unsigned char)Divide_255(data[i + c] * factor_a + other[i + c] * factor_b);
+    }// for
+}// Composite_Span
+
+template<ECompositeOp op>
+static void Composite(unsigned char* data, const unsigned char* other, int width, int height)
+{
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
+    {
+        Composite_Span<op>(data + first * width * 4, other + first * width * 4, (last - first) * width);
+    });
+}// Composite
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite a stack of layers in turn, tile by tile, so a tile of the
+//  destination stays in cache while every layer is applied to it and is
+//  written back once.  Each step rounds exactly as a single Comp_* would.
+//  Layers whose alpha is zero across a tile leave it unchanged or clear it,
+//  depending on the operator, without blending.  A tile that "over" has made
+//  opaque ignores the layers still below it.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<ECompositeOp op>
+static void Composite_Stack(unsigned char* data, TargaImage** apLayers, int layers, int width, int height)
+{
+    int columns = (width + c_stackTile - 1) / c_stackTile;
+    int tiles = columns * ((height + c_stackTile - 1) / c_stackTile);
+    CThreadPool::ParallelFor(0, tiles, 1, [&](int first, int last)
+    {
+        for (int tile = first; tile < last; tile++)
+        {
+            int x0 = (tile % columns) * c_stackTile, x1 = Min(x0 + c_stackTile, width);
+            int y0 = (tile / columns) * c_stackTile, y1 = Min(y0 + c_stackTile, height);
+
+            for (int layer = 0; layer < layers; layer++)
+            {
+                const unsigned char* other = apLayers[layer]->data;
+                int lowest = 255, highest = 0;
+                for (int y = y0; y < y1; y++)
+                    for (int i = (y * width + x0) * 4 + 3; i < (y * width + x1) * 4; i += 4)
+                    {
+                        lowest = Min(lowest, (int)other[i]);
+                        highest = Max(highest, (int)other[i]);
+                    }// for
+
+                if (highest == 0 && op != TargaImage::COMPOSITE_IN && op != TargaImage::COMPOSITE_ATOP)
+                    continue;
+                if (lowest == 255 && op == TargaImage::COMPOSITE_IN)
+                    continue;
+                if (highest == 0)
+                {
+                    // in and atop clear where the layer is empty
+                    for (int y = y0; y < y1; y++)
+                        memset(data + (y * width + x0) * 4, 0, (x1 - x0) * 4);
+                    if (op == TargaImage::COMPOSITE_IN)
+                        break;
+                    continue;
+                }// if
+
+                for (int y = y0; y < y1; y++)
+                    Composite_Span<op>(data + (y * width + x0) * 4, other + (y * width + x0) * 4, x1 - x0);
+
+                if (op == TargaImage::COMPOSITE_OVER)
+                {
+                    bool bOpaque = true;
+                    for (int y = y0; y < y1 && bOpaque; y++)
+                        for (int i = (y * width + x0) * 4 + 3; i < (y * width + x1) * 4 && bOpaque; i += 4)
+                            bOpaque = data[i] == 255;
+                    if (bOpaque)
+                        break;
+                }// if
+            }// for
+        }// for
+    });
+}// Composite_Stack
+
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Composite the current image over the given image.  Return success of 
@@ -710,14 +1484,17 @@ bool TargaImage::Dither_Color()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Over(TargaImage* pImage)
 {
+    if (!pImage)
+        return false;
+
     if (width != pImage->width || height != pImage->height)
     {
-        cout <<  "Comp_Over: Images not the same size\n";
+        cout << "Comp_Over: Images not the same size\n";
         return false;
     }
 
-    ClearToBlack();
-    return false;
+    Composite<COMPOSITE_OVER>(data, pImage->data, width, height);
+    return true;
 }// Comp_Over
 
 
@@ -729,14 +1506,17 @@ bool TargaImage::Comp_Over(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_In(TargaImage* pImage)
 {
+    if (!pImage)
+        return false;
+
     if (width != pImage->width || height != pImage->height)
     {
         cout << "Comp_In: Images not the same size\n";
         return false;
     }
 
-    ClearToBlack();
-    return false;
+    Composite<COMPOSITE_IN>(data, pImage->data, width, height);
+    return true;
 }// Comp_In
 
 
@@ -748,14 +1528,17 @@ bool TargaImage::Comp_In(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Out(TargaImage* pImage)
 {
+    if (!pImage)
+        return false;
+
     if (width != pImage->width || height != pImage->height)
     {
         cout << "Comp_Out: Images not the same size\n";
         return false;
     }
 
-    ClearToBlack();
-    return false;
+    Composite<COMPOSITE_OUT>(data, pImage->data, width, height);
+    return true;
 }// Comp_Out
 
 
@@ -767,14 +1550,17 @@ bool TargaImage::Comp_Out(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Atop(TargaImage* pImage)
 {
+    if (!pImage)
+        return false;
+
     if (width != pImage->width || height != pImage->height)
     {
         cout << "Comp_Atop: Images not the same size\n";
         return false;
     }
 
-    ClearToBlack();
-    return false;
+    Composite<COMPOSITE_ATOP>(data, pImage->data, width, height);
+    return true;
 }// Comp_Atop
 
 
@@ -786,17 +1572,54 @@ bool TargaImage::Comp_Atop(TargaImage* pImage)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Comp_Xor(TargaImage* pImage)
 {
+    if (!pImage)
+        return false;
+
     if (width != pImage->width || height != pImage->height)
     {
         cout << "Comp_Xor: Images not the same size\n";
         return false;
     }
 
-    ClearToBlack();
-    return false;
+    Composite<COMPOSITE_XOR>(data, pImage->data, width, height);
+    return true;
 }// Comp_Xor
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite this image with each of the given layers in turn, the same
+//  as one Comp_* per layer, in a single pass over the image.  All layers must
+//  match the image size.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Comp_Stack(ECompositeOp op, TargaImage** apLayers, int layers)
+{
+    for (int layer = 0; layer < layers; layer++)
+    {
+        if (!apLayers[layer])
+            return false;
+
+        if (width != apLayers[layer]->width || height != apLayers[layer]->height)
+        {
+            cout << "Comp_Stack: Images not the same size\n";
+            return false;
+        }// if
+    }// for
+
+    switch (op)
+    {
+        case COMPOSITE_OVER:    Composite_Stack<COMPOSITE_OVER>(data, apLayers, layers, width, height);    break;
+        case COMPOSITE_IN:      Composite_Stack<COMPOSITE_IN>(data, apLayers, layers, width, height);      break;
+        case COMPOSITE_OUT:     Composite_Stack<COMPOSITE_OUT>(data, apLayers, layers, width, height);     break;
+        case COMPOSITE_ATOP:    Composite_Stack<COMPOSITE_ATOP>(data, apLayers, layers, width, height);    break;
+        case COMPOSITE_XOR:     Composite_Stack<COMPOSITE_XOR>(data, apLayers, layers, width, height);     break;
+    }// switch
+
+    return true;
+}// Comp_Stack
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Calculate the difference bewteen this imag and the given one.  Image 
@@ -814,19 +1637,22 @@ bool TargaImage::Difference(TargaImage* pImage)
         return false;
     }// if
 
-    for (int i = 0; i < width * height * 4; i += 4)
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
     {
-        unsigned char        rgb1[3];
-        unsigned char        rgb2[3];
+        for (int i = first * width * 4; i < last * width * 4; i += 4)
+        {
+            unsigned char        rgb1[3];
+            unsigned char        rgb2[3];
 
-        RGBA_To_RGB(data + i, rgb1);
-        RGBA_To_RGB(pImage->data + i, rgb2);
+            RGBA_To_RGB(data + i, rgb1);
+            RGBA_To_RGB(pImage->data + i, rgb2);
 
-        data[i] = abs(rgb1[0] - rgb2[0]);
-        data[i + 1] = abs(rgb1[1] - rgb2[1]);
-        data[i + 2] = abs(rgb1[2] - rgb2[2]);
-        data[i + 3] = 255;
-    }
+            data[i] = abs(rgb1[0] - rgb2[0]);
+            data[i + 1] = abs(rgb1[1] - rgb2[1]);
+            data[i + 2] = abs(rgb1[2] - rgb2[2]);
+            data[i + 3] = 255;
+        }
+    });
 
     return true;
 }// Difference
@@ -840,46 +1666,46 @@ bool TargaImage::Difference(TargaImage* pImage)
 bool TargaImage::Filter(float filter[5][5],float filter_div, unsigned char* output_data)
 {
     unsigned char* original_data = new unsigned char[width * height * 4];
-    for (int i = 0; i < (width * height * 4); i++)
+    memcpy(original_data, output_data, width * height * 4);
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
     {
-        original_data[i] = output_data[i];
-    }
-    for (int i = 0; i < (width * height * 4); i = i + 4)
-    {
-        float avg_red = 0, avg_green = 0, avg_blue = 0;
-        
-        for (int h = 0; h < 5; h++)
+        for (int i = first * width * 4; i < last * width * 4; i = i + 4)
         {
-            for (int w = 0; w < 5; w++)
+            float avg_red = 0, avg_green = 0, avg_blue = 0;
+        
+            for (int h = 0; h < 5; h++)
             {
-                int box_pos = i + ((h - 2) * width * 4) + ((w - 2) * 4);
-                int row = box_pos / (width * 4);
-                int col = box_pos % (width * 4) / 4;
-                if (row >= 2 && row < height - 2 && col >= 2 && col < width - 2)
+                for (int w = 0; w < 5; w++)
                 {
-                                avg_red += original_data[box_pos] * filter[h][w];
-                                avg_green += original_data[box_pos + 1] * filter[h][w];
-                                avg_blue += original_data[box_pos + 2] * filter[h][w];
+                    int box_pos = i + ((h - 2) * width * 4) + ((w - 2) * 4);
+                    int row = box_pos / (width * 4);
+                    int col = box_pos % (width * 4) / 4;
+                    if (row >= 2 && row < height - 2 && col >= 2 && col < width - 2)
+                    {
+                                    avg_red += original_data[box_pos] * filter[h][w];
+                                    avg_green += original_data[box_pos + 1] * filter[h][w];
+                                    avg_blue += original_data[box_pos + 2] * filter[h][w];
+                    }
                 }
             }
+            int new_red, new_green, new_blue;
+            if ((int)avg_red > 0)
+                new_red = int(float(avg_red / filter_div) + 0.5);
+            else
+                new_red = 0;
+            if ((int)avg_green > 0)
+                new_green = int(float(avg_green / filter_div) + 0.5);
+            else
+                new_green = 0;
+            if ((int)avg_blue > 0)
+                new_blue = int(float(avg_blue / filter_div) + 0.5);
+            else
+                new_blue = 0;
+            output_data[i] = new_red;
+            output_data[i + 1] = new_green;
+            output_data[i + 2] = new_blue;
         }
-        int new_red, new_green, new_blue;
-        if ((int)avg_red > 0)
-            new_red = int(float(avg_red / filter_div) + 0.5);
-        else
-            new_red = 0;
-        if ((int)avg_green > 0)
-            new_green = int(float(avg_green / filter_div) + 0.5);
-        else
-            new_green = 0;
-        if ((int)avg_blue > 0)
-            new_blue = int(float(avg_blue / filter_div) + 0.5);
-        else
-            new_blue = 0;
-        output_data[i] = new_red;
-        output_data[i + 1] = new_green;
-        output_data[i + 2] = new_blue;
-    }
+    });
     delete[] original_data;
     return true;
 }
@@ -896,6 +1722,40 @@ bool TargaImage::Filter_Box()
 }// Filter_Box
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Average every channel over the (2 * radius + 1) square around each
+//  pixel, from a summed-area table so the cost doesn't depend on the radius.
+//  Near the edges only the pixels inside the image are averaged.  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box_N(unsigned int radius)
+{
+    if (!data)
+        return false;
+
+    CSummedAreaTable sums(*this);
+    int reach = (int)Min(radius, (unsigned int)Max(width, height));
+    CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
+    {
+        for (int y = first; y < last; y++)
+        {
+            int y0 = Max(y - reach, 0), y1 = Min(y + reach + 1, height);
+            for (int x = 0; x < width; x++)
+            {
+                int x0 = Max(x - reach, 0), x1 = Min(x + reach + 1, width);
+                unsigned long long count = (unsigned long long)(x1 - x0) * (y1 - y0);
+                for (int c = 0; c < 4; c++)
+                    data[(y * width + x) * 4 + c] = (unsigned char)((sums.Sum(x0, y0, x1, y1, c) + count / 2) / count);
+            }// for
+        }// for
+    });
+
+    return true;
+}// Filter_Box_N
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Perform 5x5 Bartlett filter on this image.  Return success of 
@@ -968,44 +1828,45 @@ bool TargaImage::Filter_Gaussian_N( unsigned int N )
         }
     }
 
-    // Apply filter
+    // Apply filter, rows in parallel; each pixel costs N*N taps, so grain by taps
     unsigned char* original_data = new unsigned char[width * height * 4];
-    for (int i = 0; i < (width * height * 4); i++) {
-        original_data[i] = data[i];
-    }
+    memcpy(original_data, data, width * height * 4);
 
-    for (int i = 0; i < (width * height * 4); i = i + 4) {
-        float avg_red = 0, avg_green = 0, avg_blue = 0;
-
-        for (int h = 0; h < N; h++) {
-            for (int w = 0; w < N; w++) {
-                int box_pos = i + ((h - (N / 2)) * width * 4) + ((w - (N / 2)) * 4);
-                int row = box_pos / (width * 4);
-                int col = box_pos % (width * 4) / 4;
-                if (row >= (N / 2) && row < height - (N / 2) && col >= (N / 2) && col < width - (N / 2)) {
-                    avg_red += original_data[box_pos] * filter[h][w];
-                    avg_green += original_data[box_pos + 1] * filter[h][w];
-                    avg_blue += original_data[box_pos + 2] * filter[h][w];
+    CThreadPool::ParallelFor(0, height, RowGrain(width * N * N), [&](int first, int last)
+    {
+        for (int i = first * width * 4; i < (last * width * 4); i = i + 4) {
+            float avg_red = 0, avg_green = 0, avg_blue = 0;
+
+            for (int h = 0; h < N; h++) {
+                for (int w = 0; w < N; w++) {
+                    int box_pos = i + ((h - (N / 2)) * width * 4) + ((w - (N / 2)) * 4);
+                    int row = box_pos / (width * 4);
+                    int col = box_pos % (width * 4) / 4;
+                    if (row >= (N / 2) && row < height - (N / 2) && col >= (N / 2) && col < width - (N / 2)) {
+                        avg_red += original_data[box_pos] * filter[h][w];
+                        avg_green += original_data[box_pos + 1] * filter[h][w];
+                        avg_blue += original_data[box_pos + 2] * filter[h][w];
+                    }
                 }
             }
+            int new_red, new_green, new_blue;
+            if ((int)avg_red > 0)
+                new_red = int(float(avg_red / filter_div) + 0.5);
+            else
+                new_red = 0;
+            if ((int)avg_green > 0)
+                new_green = int(float(avg_green / filter_div) + 0.5);
+            else
+                new_green = 0;
+            if ((int)avg_blue > 0)
+                new_blue = int(float(avg_blue / filter_div) + 0.5);
+            else
+                new_blue = 0;
+            data[i] = new_red;
+            data[i + 1] = new_green;
+            data[i + 2] = new_blue;
         }
-        int new_red, new_green, new_blue;
-        if ((int)avg_red > 0)
-            new_red = int(float(avg_red / filter_div) + 0.5);
-        else
-            new_red = 0;
-        if ((int)avg_green > 0)
-            new_green = int(float(avg_green / filter_div) + 0.5);
-        else
-            new_green = 0;
-        if ((int)avg_blue > 0)
-            new_blue = int(float(avg_blue / filter_div) + 0.5);
-        else
-            new_blue = 0;
-        data[i] = new_red;
-        data[i + 1] = new_green;
-        data[i + 2] = new_blue;
-    }
+    });
 
     delete[] original_data;
     // Delete dynamically allocated memory for the filter
@@ -1062,6 +1923,29 @@ bool TargaImage::Filter_Enhance()
 }// Filter_Enhance
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Difference between the canvas and the reference at every pixel, the
+//  RGB distance, or c_unpainted where nothing has been painted yet.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Paint_Difference(const unsigned char* canvas, const unsigned char* reference, int pixels, int* difference)
+{
+    for (int i = 0; i < pixels; i++)
+    {
+        const unsigned char* p = canvas + i * 4;
+        const unsigned char* q = reference + i * 4;
+        if (!p[3])
+            difference[i] = c_unpainted;
+        else
+        {
+            int red = p[0] - q[0], green = p[1] - q[1], blue = p[2] - q[2];
+            difference[i] = (int)sqrt((double)(red * red + green * green + blue * blue));
+        }// else
+    }// for
+}// Paint_Difference
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Run simplified version of Hertzmann's painterly image filter.
@@ -1069,12 +1953,104 @@ bool TargaImage::Filter_Enhance()
 //      Stroke class to help.
 // Return success of operation.
 //
+//  Layers of strokes of radius 7, 3 and 1 are painted onto a blank canvas,
+//  each against the image blurred by a Gaussian twice its radius wide.  The
+//  canvas is split into cells the size of the radius; a cell whose mean
+//  difference from the reference exceeds c_paintThreshold gets one stroke,
+//  at its worst pixel, in the reference color there.  A layer's strokes are
+//  painted in an order shuffled from the seed.  Cells are judged and tiles
+//  of the canvas painted in parallel; the result doesn't depend on threads.
+//
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::NPR_Paint()
+bool TargaImage::NPR_Paint(unsigned int seed)
 {
-    ClearToBlack();
-    return false;
-}
+    if (!data)
+        return false;
+
+    unsigned char* canvas = new unsigned char[width * height * 4];
+    memset(canvas, 0, width * height * 4);
+    vector<int> vDifference(width * height);
+    unsigned long long state = c_paintSeed ^ seed;
+
+    for (size_t layer = 0; layer < sizeof(c_paintRadii) / sizeof(c_paintRadii[0]); layer++)
+    {
+        int radius = c_paintRadii[layer];
+        TargaImage reference(*this);
+        reference.Filter_Gaussian_N(2 * radius + 1);
+        CThreadPool::ParallelFor(0, height, RowGrain(width), [&](int first, int last)
+        {
+            Paint_Difference(canvas + first * width * 4, reference.data + first * width * 4, (last - first) * width, &vDifference[first * width]);
+        });
+
+        // cells are judged a row at a time in parallel, then joined in order;
+        // only cells over the threshold are searched for their worst pixel
+        CSummedAreaTable errors(&vDifference[0], width, height);
+        int cell_rows = (height + radius - 1) / radius;
+        vector<vector<Stroke> > vvRowStrokes(cell_rows);
+        CThreadPool::ParallelFor(0, cell_rows, 1, [&](int first, int last)
+        {
+            for (int cell_row = first; cell_row < last; cell_row++)
+            {
+                int y0 = cell_row * radius, y1 = Min(y0 + radius, height);
+                for (int x0 = 0; x0 < width; x0 += radius)
+                {
+                    int x1 = Min(x0 + radius, width);
+                    if (errors.Sum(x0, y0, x1, y1) <= (unsigned long long)c_paintThreshold * (x1 - x0) * (y1 - y0))
+                        continue;
+
+                    int worst = y0 * width + x0;
+                    for (int y = y0; y < y1; y++)
+                        for (int x = x0; x < x1; x++)
+                            if (vDifference[y * width + x] > vDifference[worst])
+                                worst = y * width + x;
+
+                    // blurring doesn't touch alpha, keep the stroke premultiplied
+                    const unsigned char* color = reference.data + worst * 4;
+                    vvRowStrokes[cell_row].push_back(Stroke(radius, worst % width, worst / width,
+                                                            Min(color[0], color[3]), Min(color[1], color[3]), Min(color[2], color[3]), color[3]));
+                }// for
+            }// for
+        });
+
+        vector<Stroke> vStrokes;
+        for (int cell_row = 0; cell_row < cell_rows; cell_row++)
+            vStrokes.insert(vStrokes.end(), vvRowStrokes[cell_row].begin(), vvRowStrokes[cell_row].end());
+
+        for (size_t i = vStrokes.size(); i > 1; i--)
+            swap(vStrokes[i - 1], vStrokes[NextRandom(state) % i]);
+
+        // bin the strokes by the tiles they touch, keeping their order, and
+        // paint the tiles in parallel; every pixel sees its strokes in order
+        int columns = (width + c_paintTile - 1) / c_paintTile;
+        vector<vector<int> > vvTileStrokes(columns * ((height + c_paintTile - 1) / c_paintTile));
+        for (size_t i = 0; i < vStrokes.size(); i++)
+        {
+            const Stroke& stroke = vStrokes[i];
+            int x0 = Max((int)stroke.x - radius, 0) / c_paintTile, x1 = Min((int)stroke.x + radius, width - 1) / c_paintTile;
+            int y0 = Max((int)stroke.y - radius, 0) / c_paintTile, y1 = Min((int)stroke.y + radius, height - 1) / c_paintTile;
+            for (int tile_y = y0; tile_y <= y1; tile_y++)
+                for (int tile_x = x0; tile_x <= x1; tile_x++)
+                    vvTileStrokes[tile_y * columns + tile_x].push_back((int)i);
+        }// for
+
+        swap(data, canvas);
+        CThreadPool::ParallelFor(0, (int)vvTileStrokes.size(), 1, [&](int first, int last)
+        {
+            for (int tile = first; tile < last; tile++)
+            {
+                int x0 = (tile % columns) * c_paintTile, y0 = (tile / columns) * c_paintTile;
+                int x1 = Min(x0 + c_paintTile, width), y1 = Min(y0 + c_paintTile, height);
+                for (size_t i = 0; i < vvTileStrokes[tile].size(); i++)
+                    Paint_Stroke(vStrokes[vvTileStrokes[tile][i]], x0, y0, x1, y1);
+            }// for
+        });
+        swap(data, canvas);
+    }// for
+
+    delete[] data;
+    data = canvas;
+    return true;
+}// NPR_Paint
 
 
 
@@ -1083,71 +2059,156 @@ bool TargaImage::NPR_Paint()
 //      Halve the dimensions of this image.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Reconstruct(float filter[3][3], float filter_div, unsigned char* output_data)
+bool TargaImage::Half_Size()
 {
-    unsigned char* original_data = new unsigned char[width * height * 4];
-    for (int i = 0; i < (width * height * 4); i++)//copy output_data
+    return Half_Size_N(1);
+}// Half_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Divide the dimensions of this image by 2^levels in a single pass.  The
+//  filter is the 1 2 1 Bartlett kernel of a single halving composed levels
+//  times, applied separably at each output pixel straight from the source
+//  rows into the new buffer.  All four channels are filtered and edges are
+//  clamped.  The filter sums 16^levels weighted pixels, so at most
+//  c_maxHalvings levels are taken at once.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Half_Size_N(unsigned int levels)
+{
+    if (!data || levels < 1 || levels > c_maxHalvings || !(width >> levels) || !(height >> levels))
+        return false;
+
+    // compose the kernel, each level spreads the previous one twice as far
+    vector<int> kernel(1, 1);
+    for (unsigned level = 0; level < levels; level++)
     {
-        original_data[i] = output_data[i];
-    }
-    for (int i = 0; i < height / 2; i++)//looping by height
+        int step = 1 << level;
+        vector<int> composed(kernel.size() + 2 * step, 0);
+        for (size_t t = 0; t < kernel.size(); t++)
+        {
+            composed[t] += kernel[t];
+            composed[t + step] += 2 * kernel[t];
+            composed[t + 2 * step] += kernel[t];
+        }// for
+        kernel.swap(composed);
+    }// for
+
+    unsigned char* output_data = new unsigned char[(width >> levels) * (height >> levels) * 4];
+    if (levels <= 5)
+        Half_Rows<unsigned>(data, output_data, width, height, levels, kernel);
+    else
+        Half_Rows<unsigned long long>(data, output_data, width, height, levels, kernel);
+
+    delete[] data;
+    data = output_data;
+    width >>= levels;
+    height >>= levels;
+    return true;
+}// Half_Size_N
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write the mipmap chain of this image to prefix_<level>.tga, from the
+//  image itself at level 0 down to 1x1.  Each level is the previous one put
+//  through Half_Size's filter.
+//
+//  Levels are built in bands of c_mipBand rows of level 1.  Within a band
+//  every new row of a level immediately produces whatever rows of the next
+//  level it completes, so the small levels are computed from rows still in
+//  cache instead of from a second pass over memory.  The first row of a band
+//  below level 1 also reads the last row of the previous band; those rows
+//  are left for a short serial pass after the bands, as are levels whose
+//  bands would be under a row tall.  The levels are then written in parallel.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Mipmaps(const char* sPrefix)
+{
+    if (!data || !sPrefix)
+        return false;
+
+    vector<TargaImage*> vLevels(1, this);
+    while (vLevels.back()->width > 1 || vLevels.back()->height > 1)
+        vLevels.push_back(new TargaImage(Max(vLevels.back()->width >> 1, 1), Max(vLevels.back()->height >> 1, 1)));
+
+    // levels 1 through banded are built band by band
+    int levels = (int)vLevels.size();
+    int banded = 0;
+    while (banded + 1 < levels && (c_mipBand >> banded) >= 1)
+        banded++;
+
+    int bands = (vLevels[1 < levels ? 1 : 0]->height + c_mipBand - 1) / c_mipBand;
+    CThreadPool::ParallelFor(0, levels > 1 ? bands : 0, 1, [&](int first, int last)
     {
-        int offset = i * width * 4 * 2;//offset to point to the height in data
-        for (int j = 0; j < width / 2; j++)//looping by width
+        for (int band = first; band < last; band++)
         {
-            int p = offset + j * 4 * 2;
-            float avg_red = 0, avg_green = 0, avg_blue = 0;
+            vector<int> next(banded + 1), end(banded + 1);
+            for (int level = 1; level <= banded; level++)
+            {
+                next[level] = Min((band * c_mipBand) >> (level - 1), vLevels[level]->height);
+                end[level] = Min(((band + 1) * c_mipBand) >> (level - 1), vLevels[level]->height);
+            }// for
 
-            for (int h = 0; h < 3; h++)
+            vector<int> start(next);
+            while (next[1] < end[1])
             {
-                for (int w = 0; w < 3; w++)
+                Mip_Row(*vLevels[0], *vLevels[1], next[1]++);
+                for (int level = 2; level <= banded; level++)
                 {
-                    int box_pos = p + ((h - 1) * width * 4) + ((w - 1) * 4);
-                    int row = i * 2 + (h - 1);
-                    int col = j * 2 + (w - 1);
-                    if (row >= 0 && row < height && col >= 0 && col < width)
+                    const TargaImage& above = *vLevels[level - 1];
+                    while (next[level] < end[level] && Min(2 * next[level] + 1, above.height - 1) < next[level - 1])
                     {
-                        avg_red += original_data[box_pos] * filter[h][w];
-                        avg_green += original_data[box_pos + 1] * filter[h][w];
-                        avg_blue += original_data[box_pos + 2] * filter[h][w];
-                    }
-                }
-            }
-            int new_red, new_green, new_blue;
-            if ((int)avg_red > 0)
-                new_red = int(float(avg_red / filter_div) + 0.5);
-            else
-                new_red = 0;
-            if ((int)avg_green > 0)
-                new_green = int(float(avg_green / filter_div) + 0.5);
-            else
-                new_green = 0;
-            if ((int)avg_blue > 0)
-                new_blue = int(float(avg_blue / filter_div) + 0.5);
-            else
-                new_blue = 0;
-            int q = i * (width / 2) * 4 + j * 4;
-            output_data[q] = new_red;
-            output_data[q + 1] = new_green;
-            output_data[q + 2] = new_blue;
-            output_data[q + 3] = 255; // set alpha to 255
-        }
-    }
-    delete[] original_data;
-    return true;
-}
+                        if (band == 0 || next[level] != start[level])
+                            Mip_Row(above, *vLevels[level], next[level]);
+                        next[level]++;
+                    }// while
+                }// for
+            }// while
+        }// for
+    });
+
+    // rows that straddled bands, in level order
+    for (int level = 2; level <= banded; level++)
+        for (int band = 1; band < bands; band++)
+        {
+            int row = (band * c_mipBand) >> (level - 1);
+            if (row < vLevels[level]->height)
+                Mip_Row(*vLevels[level - 1], *vLevels[level], row);
+        }// for
+
+    // levels too small to band
+    for (int level = banded + 1; level < levels; level++)
+        CThreadPool::ParallelFor(0, vLevels[level]->height, RowGrain(vLevels[level]->width), [&](int first, int last)
+        {
+            for (int y = first; y < last; y++)
+                Mip_Row(*vLevels[level - 1], *vLevels[level], y);
+        });
 
-bool TargaImage::Half_Size()
-{
-    float filter_div = 16.0;
-    float filter[3][3] = { {1, 2, 1},
-                           {2, 4, 2},
-                           {1, 2, 1} };
-    Reconstruct(filter, filter_div, data);
-    width /= 2;
-    height /= 2;
-    return true;
-}// Half_Size
+    // write the batch, one level per task
+    vector<char> vbSaved(levels, 0);
+    CThreadPool::ParallelFor(0, levels, 1, [&](int first, int last)
+    {
+        for (int level = first; level < last; level++)
+        {
+            ostringstream filename;
+            filename << sPrefix << "_" << level << ".tga";
+            vbSaved[level] = vLevels[level]->Save_Image(filename.str().c_str());
+        }// for
+    });
+
+    bool bSaved = true;
+    for (int level = 0; level < levels; level++)
+    {
+        bSaved = bSaved && vbSaved[level];
+        if (level > 0)
+            delete vLevels[level];
+    }// for
+
+    return bSaved;
+}// Save_Mipmaps
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1157,21 +2218,140 @@ bool TargaImage::Half_Size()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Double_Size()
 {
-    ClearToBlack();
-    return false;
+    if (!data || width <= 0 || height <= 0)
+        return false;
+
+    int out_width = width * 2;
+    int out_height = height * 2;
+    int in_row = width * 4;
+    int out_row = out_width * 4;
+    unsigned char* output_data = new unsigned char[out_row * out_height];
+
+    // chunks of whole input rows, each with its own scratch rows
+    int grain = Max(RowGrain(out_width), 16);
+    CThreadPool::ParallelFor(0, height, grain, [&](int first, int last)
+    {
+        // horizontally upsampled input rows first - 1 to last + 1
+        int rows = last - first + 3;
+        vector<unsigned short> upsampled(rows * out_row);
+        vector<unsigned char> padded((width + 3) * 4);
+        for (int r = 0; r < rows; r++)
+        {
+            int source = Min(Max(first - 1 + r, 0), height - 1);
+            Double_Row(data + source * in_row, width, &padded[0], &upsampled[r * out_row]);
+        }
+
+        for (int i = first; i < last; i++)
+        {
+            const unsigned short* above = &upsampled[(i - first) * out_row];
+            const unsigned short* center = above + out_row;
+            const unsigned short* below = center + out_row;
+            const unsigned short* below2 = below + out_row;
+            unsigned char* even = output_data + (2 * i) * out_row;
+            unsigned char* odd = even + out_row;
+
+            // even rows 2,4,2 and odd rows 1,3,3,1, both scaled by 8 after the
+            // horizontal pass, so each output is the sum over 64 rounded
+            for (int k = 0; k < out_row; k++)
+            {
+                even[k] = (unsigned char)((2 * above[k] + 4 * center[k] + 2 * below[k] + 32) >> 6);
+                odd[k] = (unsigned char)((above[k] + 3 * center[k] + 3 * below[k] + below2[k] + 32) >> 6);
+            }
+        }
+    });
+
+    delete[] data;
+    data = output_data;
+    width = out_width;
+    height = out_height;
+    return true;
 }// Double_Size
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Scale the image dimensions by the given factor.  The given factor is 
-//  assumed to be greater than one.  Return success of operation.
+//      Scale the image dimensions by the given factor with a two pass
+//  separable resampler.  Tap positions and fixed point weights are computed
+//  once per output column and row; the rows are resampled in parallel, each
+//  chunk running the horizontal pass over just the input rows it needs.
+//  Scaling a box filter by exactly 1/2^k takes a direct block average path.
+//  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Resize(float scale)
+bool TargaImage::Resize(float scale, EResizeKernel kernel)
 {
-    ClearToBlack();
-    return false;
+    if (!data || width <= 0 || height <= 0 || scale <= 0)
+        return false;
+
+    int out_width = Max((int)(width * scale + 0.5f), 1);
+    int out_height = Max((int)(height * scale + 0.5f), 1);
+    unsigned char* output_data;
+
+    int factor = (int)(1 / scale + 0.5f);
+    if (kernel == RESIZE_BOX && factor >= 2 && !(factor & (factor - 1)) && scale * factor == 1.0f)
+        output_data = Box_Reduce(data, width, height, factor, out_width, out_height);
+    else
+    {
+        SResampleTaps columns, rows;
+        Compute_Taps(width, out_width, kernel, columns);
+        Compute_Taps(height, out_height, kernel, rows);
+        output_data = new unsigned char[out_width * out_height * 4];
+
+        int out_row = out_width * 4;
+        int grain = Max(RowGrain(out_width), 32);
+        CThreadPool::ParallelFor(0, out_height, grain, [&](int first, int last)
+        {
+            // horizontal pass over the input rows this chunk reads
+            int row_first = rows.vStart[first];
+            int row_count = rows.vStart[last - 1] + rows.taps - row_first;
+            vector<int> intermediate(row_count * out_row);
+            for (int r = 0; r < row_count; r++)
+            {
+                const unsigned char* source = data + (row_first + r) * width * 4;
+                int* target = &intermediate[r * out_row];
+                for (int x = 0; x < out_width; x++)
+                {
+                    const int* weights = &columns.vWeights[x * columns.taps];
+                    const unsigned char* p = source + columns.vStart[x] * 4;
+                    int sum[4] = { 0, 0, 0, 0 };
+                    for (int t = 0; t < columns.taps; t++, p += 4)
+                        for (int c = 0; c < 4; c++)
+                            sum[c] += weights[t] * p[c];
+                    for (int c = 0; c < 4; c++)
+                        target[x * 4 + c] = (sum[c] + (1 << (c_passShift - 1))) >> c_passShift;
+                }
+            }
+
+            // vertical pass, straight into the output
+            vector<int> sum(out_row);
+            const int shift = 2 * c_weightBits - c_passShift;
+            for (int y = first; y < last; y++)
+            {
+                const int* weights = &rows.vWeights[y * rows.taps];
+                const int* source = &intermediate[(rows.vStart[y] - row_first) * out_row];
+                fill(sum.begin(), sum.end(), 1 << (shift - 1));
+                for (int t = 0; t < rows.taps; t++, source += out_row)
+                    for (int k = 0; k < out_row; k++)
+                        sum[k] += weights[t] * source[k];
+
+                unsigned char* target = output_data + y * out_row;
+                for (int k = 0; k < out_row; k += 4)
+                {
+                    // kernels with negative lobes can overshoot, keep the colors premultiplied
+                    int alpha = Min(Max(sum[k + 3] >> shift, 0), 255);
+                    for (int c = 0; c < 3; c++)
+                        target[k + c] = (unsigned char)Min(Max(sum[k + c] >> shift, 0), alpha);
+                    target[k + 3] = (unsigned char)alpha;
+                }
+            }
+        });
+    }// else
+
+    delete[] data;
+    data = output_data;
+    width = out_width;
+    height = out_height;
+    return true;
 }// Resize
 
 
@@ -1180,11 +2360,32 @@ bool TargaImage::Resize(float scale)
 //      Rotate the image clockwise by the given angle.  Do not resize the 
 //  image.  Return success of operation.
 //
+//  The image turns about its center and areas uncovered are transparent.
+//  Multiples of 90 degrees move whole pixels with blocked copies; other
+//  angles map each output pixel back into the source and sample it
+//  bilinearly.
+//
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Rotate(float angleDegrees)
 {
-    ClearToBlack();
-    return false;
+    if (!data)
+        return false;
+
+    double angle = fmod((double)angleDegrees, 360.0);
+    if (angle < 0)
+        angle += 360.0;
+    if (angle == 0)
+        return true;
+
+    unsigned char* output_data = new unsigned char[width * height * 4];
+    if (angle == 90 || angle == 180 || angle == 270)
+        Rotate_Quarters(data, output_data, width, height, (int)angle / 90);
+    else
+        Rotate_Bilinear(data, output_data, width, height, angle * c_piDouble / 180);
+
+    delete[] data;
+    data = output_data;
+    return true;
 }// Rotate
 
 
@@ -1196,33 +2397,7 @@ bool TargaImage::Rotate(float angleDegrees)
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb)
 {
-    const unsigned char	BACKGROUND[3] = { 0, 0, 0 };
-
-    unsigned char  alpha = rgba[3];
-
-    if (alpha == 0)
-    {
-        rgb[0] = BACKGROUND[0];
-        rgb[1] = BACKGROUND[1];
-        rgb[2] = BACKGROUND[2];
-    }
-    else
-    {
-	    float	alpha_scale = (float)255 / (float)alpha;
-	    int	val;
-	    int	i;
-
-	    for (i = 0 ; i < 3 ; i++)
-	    {
-	        val = (int)floor(rgba[i] * alpha_scale);
-	        if (val < 0)
-		    rgb[i] = 0;
-	        else if (val > 255)
-		    rgb[i] = 255;
-	        else
-		    rgb[i] = val;
-	    }
-    }
+    alpha_display_row(rgba, rgb, 1, BACKGROUND);
 }// RGA_To_RGB
 
 
@@ -1277,35 +2452,42 @@ void TargaImage::ClearToBlack()
 //      Helper function for the painterly filter; paint a stroke at
 // the given location
 //
+//  Offsets within the radius are set to the stroke color and offsets whose
+//  squared distance is one more than the radius squared are averaged with
+//  it.  Each row of the stroke is a solid span plus, maybe, one averaged
+//  pixel past each end, taken from a table for the radius.  The clipped
+//  version paints only the part inside [x0, x1) x [y0, y1).
+//
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::Paint_Stroke(const Stroke& s) {
-   int radius_squared = (int)s.radius * (int)s.radius;
-   for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
-      for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
-         int x_loc = (int)s.x + x_off;
-         int y_loc = (int)s.y + y_off;
-         // are we inside the circle, and inside the image?
-         if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
-            int dist_squared = x_off * x_off + y_off * y_off;
-            if (dist_squared <= radius_squared) {
-               data[(y_loc * width + x_loc) * 4 + 0] = s.r;
-               data[(y_loc * width + x_loc) * 4 + 1] = s.g;
-               data[(y_loc * width + x_loc) * 4 + 2] = s.b;
-               data[(y_loc * width + x_loc) * 4 + 3] = s.a;
-            } else if (dist_squared == radius_squared + 1) {
-               data[(y_loc * width + x_loc) * 4 + 0] = 
-                  (data[(y_loc * width + x_loc) * 4 + 0] + s.r) / 2;
-               data[(y_loc * width + x_loc) * 4 + 1] = 
-                  (data[(y_loc * width + x_loc) * 4 + 1] + s.g) / 2;
-               data[(y_loc * width + x_loc) * 4 + 2] = 
-                  (data[(y_loc * width + x_loc) * 4 + 2] + s.b) / 2;
-               data[(y_loc * width + x_loc) * 4 + 3] = 
-                  (data[(y_loc * width + x_loc) * 4 + 3] + s.a) / 2;
-            }
-         }
-      }
-   }
-}
+    Paint_Stroke(s, 0, 0, width, height);
+}// Paint_Stroke
+
+void TargaImage::Paint_Stroke(const Stroke& s, int clip_x0, int clip_y0, int clip_x1, int clip_y1)
+{
+    vector<SCircleSpan> vLocalSpans;
+    const vector<SCircleSpan>& vSpans = Circle_Spans(s.radius, vLocalSpans);
+    const unsigned char color[4] = { s.r, s.g, s.b, s.a };
+    int radius = (int)s.radius;
+
+    for (int y_off = Max(-radius, clip_y0 - (int)s.y); y_off <= radius && (int)s.y + y_off < clip_y1; y_off++)
+    {
+        const SCircleSpan& span = vSpans[y_off + radius];
+        unsigned char* row = data + ((int)s.y + y_off) * width * 4;
+        int first = Max((int)s.x - span.half, clip_x0), last = Min((int)s.x + span.half, clip_x1 - 1);
+        if (first <= last)
+            Fill_Span(row + first * 4, color, last - first + 1);
+
+        if (span.bEdge)
+        {
+            int edges[2] = { (int)s.x - span.half - 1, (int)s.x + span.half + 1 };
+            for (int e = 0; e < 2; e++)
+                if (edges[e] >= clip_x0 && edges[e] < clip_x1)
+                    for (int c = 0; c < 4; c++)
+                        row[edges[e] * 4 + c] = (unsigned char)((row[edges[e] * 4 + c] + color[c]) / 2);
+        }// if
+    }// for
+}// Paint_Stroke
 
 
 ///////////////////////////////////////////////////////////////////////////////
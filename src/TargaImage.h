@@ -12,8 +12,6 @@
 #ifndef _TARGA_IMAGE_H_
 #define _TARGA_IMAGE_H_
 
-#include <Fl/Fl.h>
-#include <Fl/Fl_Widget.h>
 #include <stdio.h>
 
 class Stroke;
@@ -30,7 +28,9 @@ class TargaImage
 	    ~TargaImage(void);
 
         unsigned char*	To_RGB(void);	            // Convert the image to RGB format,
+        void To_RGB(int x, int y, int w, int h, unsigned char* rgb);   // convert a rectangle into rgb, w pixels per row
         bool Save_Image(const char*);               // save the image to a file
+        bool Save_Mipmaps(const char* sPrefix);     // save the mipmap chain to prefix_<level>.tga
         static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure
 
         bool To_Grayscale();
@@ -44,6 +44,9 @@ class TargaImage
         bool Dither_FS();
         bool Dither_Bright();
         bool Dither_Cluster();
+        bool Dither_Bayer(unsigned int order);                  // 2^order square matrix
+        bool Dither_Pattern(const TargaImage* pTile);           // thresholds from the tile's gray values
+        bool Dither_Ordered(const unsigned char* thresholds, int tileWidth, int tileHeight);   // white where gray > threshold
         bool Dither_Color();
 
         bool Comp_Over(TargaImage* pImage);
@@ -51,22 +54,26 @@ class TargaImage
         bool Comp_Out(TargaImage* pImage);
         bool Comp_Atop(TargaImage* pImage);
         bool Comp_Xor(TargaImage* pImage);
+        enum ECompositeOp { COMPOSITE_OVER, COMPOSITE_IN, COMPOSITE_OUT, COMPOSITE_ATOP, COMPOSITE_XOR };
+        bool Comp_Stack(ECompositeOp op, TargaImage** apLayers, int layers);
 
         bool Difference(TargaImage* pImage);
         bool Filter(float filter[5][5], float filter_div, unsigned char* output_data);
-        bool Reconstruct(float filter[3][3], float filter_div, unsigned char* output_data);
         bool Filter_Box();
+        bool Filter_Box_N(unsigned int radius);
         bool Filter_Bartlett();
         bool Filter_Gaussian();
         bool Filter_Gaussian_N(unsigned int N);
         bool Filter_Edge();
         bool Filter_Enhance();
 
-        bool NPR_Paint();
+        bool NPR_Paint(unsigned int seed = 0);
 
         bool Half_Size();
+        bool Half_Size_N(unsigned int levels);
         bool Double_Size();
-        bool Resize(float scale);
+        enum EResizeKernel { RESIZE_BOX, RESIZE_BARTLETT, RESIZE_MITCHELL, RESIZE_LANCZOS3 };
+        bool Resize(float scale, EResizeKernel kernel = RESIZE_BARTLETT);
         bool Rotate(float angleDegrees);
 
     private:
@@ -81,6 +88,7 @@ class TargaImage
 
 	// Draws a filled circle according to the stroke data
         void Paint_Stroke(const Stroke& s);
+        void Paint_Stroke(const Stroke& s, int x0, int y0, int x1, int y1);
 
     // members
     public:
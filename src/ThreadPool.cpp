@@ -0,0 +1,358 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.cpp
+//
+//      Implementation of CThreadPool methods.  Each worker owns a locked
+//  deque; it pops new work from the back of its own and steals from the front
+//  of the others.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <stdlib.h>
+
+using namespace std;
+
+// constants
+const char      c_sThreadsVariable[]    = "IMAGEEDITING_THREADS";       // environment variable giving the thread count
+
+// one ParallelFor call
+struct CThreadPool::SJob
+{
+    const function<void (int, int)>*    pBody;
+    SProgress*                          pProgress;      // of the thread that started the job
+    atomic<int>                         remaining;      // chunks not yet finished
+    mutex                               errorLock;
+    exception_ptr                       error;
+};// SJob
+
+// statics
+static int  s_requestedThreads  = 0;        // set before the pool exists
+static thread_local CThreadPool::SProgress* s_pProgress = NULL;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Thread count used when none was requested.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int DefaultThreadCount()
+{
+    const char* sThreads = getenv(c_sThreadsVariable);
+    if (sThreads && atoi(sThreads) > 0)
+        return atoi(sThreads);
+
+    return Max((int)thread::hardware_concurrency(), 1);
+}// DefaultThreadCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor and destructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool::CThreadPool() : m_threads(1), m_queued(0), m_nextQueue(0), m_bStopping(false)
+{
+    Start(s_requestedThreads > 0 ? s_requestedThreads : DefaultThreadCount());
+}// CThreadPool
+
+CThreadPool::~CThreadPool()
+{
+    Stop();
+}// ~CThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The process wide pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+CThreadPool& CThreadPool::Instance()
+{
+    static CThreadPool pool;
+    return pool;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Thread count.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::SetThreadCount(int threads)
+{
+    s_requestedThreads = threads;
+
+    CThreadPool& pool = Instance();
+    int count = threads > 0 ? threads : DefaultThreadCount();
+    if (count != pool.m_threads)
+    {
+        pool.Stop();
+        pool.Start(count);
+    }// if
+}// SetThreadCount
+
+int CThreadPool::ThreadCount()
+{
+    return Instance().m_threads;
+}// ThreadCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Start and stop the workers.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Start(int threads)
+{
+    m_threads = Max(threads, 1);
+    m_bStopping = false;
+    for (int i = 0; i < m_threads - 1; ++i)
+        m_queues.push_back(unique_ptr<SQueue>(new SQueue));
+    for (int i = 0; i < m_threads - 1; ++i)
+        m_workers.push_back(thread(&CThreadPool::Worker, this, i));
+}// Start
+
+void CThreadPool::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_sleepMutex);
+        m_bStopping = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+    m_workers.clear();
+    m_queues.clear();
+}// Stop
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parallel for.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::ParallelFor(int begin, int end, int grain, const function<void (int, int)>& body)
+{
+    if (end <= begin)
+        return;
+
+    grain = Max(grain, 1);
+    if (s_pProgress)
+        s_pProgress->total += end - begin;
+
+    CThreadPool& pool = Instance();
+    if (pool.m_workers.empty() || end - begin <= grain)
+    {
+        for (int chunk = begin; chunk < end; chunk += grain)
+            RunChunk(body, chunk, Min(chunk + grain, end), s_pProgress);
+        return;
+    }// if
+
+    pool.Run(begin, end, grain, body);
+}// ParallelFor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Progress of the calling thread's work.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::SetProgress(SProgress* pProgress)
+{
+    s_pProgress = pProgress;
+}// SetProgress
+
+CThreadPool::SProgress* CThreadPool::Progress()
+{
+    return s_pProgress;
+}// Progress
+
+bool CThreadPool::IsCancelled()
+{
+    return s_pProgress && s_pProgress->bCancelled;
+}// IsCancelled
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run one chunk under the given progress, unless it was cancelled.  The
+//  progress is current while the body runs so nested calls report to it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::RunChunk(const function<void (int, int)>& body, int begin, int end, SProgress* pProgress)
+{
+    if (!pProgress)
+    {
+        body(begin, end);
+        return;
+    }// if
+
+    if (pProgress->bCancelled)
+        return;
+
+    SProgress* pOuter = s_pProgress;
+    s_pProgress = pProgress;
+    try
+    {
+        body(begin, end);
+    }// try
+    catch (...)
+    {
+        s_pProgress = pOuter;
+        throw;
+    }// catch
+    s_pProgress = pOuter;
+    pProgress->done += end - begin;
+}// RunChunk
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Queue the chunks of a range round robin over the workers and help run
+//  them until they are all done.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Run(int begin, int end, int grain, const function<void (int, int)>& body)
+{
+    SJob job;
+    job.pBody = &body;
+    job.pProgress = s_pProgress;
+    job.remaining = (end - begin + grain - 1) / grain;
+
+    int queues = (int)m_queues.size();
+    int chunksPerQueue = (job.remaining + queues - 1) / queues;
+    unsigned first = m_nextQueue++;
+    int chunk = begin;
+    for (int q = 0; q < queues && chunk < end; ++q)
+    {
+        SQueue& queue = *m_queues[(first + q) % queues];
+        lock_guard<mutex> lock(queue.lock);
+        for (int i = 0; i < chunksPerQueue && chunk < end; ++i, chunk += grain)
+        {
+            STask task = { &job, chunk, Min(chunk + grain, end) };
+            queue.tasks.push_back(task);
+            ++m_queued;
+        }// for
+    }// for
+
+    {
+        lock_guard<mutex> lock(m_sleepMutex);
+    }
+    m_wake.notify_all();
+
+    // help out, then wait for chunks other threads are still running
+    while (job.remaining > 0)
+    {
+        STask task;
+        if (Pop(-1, task))
+            Execute(task);
+        else
+        {
+            unique_lock<mutex> lock(m_doneMutex);
+            m_done.wait(lock, [&job]() { return job.remaining == 0; });
+        }// else
+    }// while
+
+    if (job.error)
+        rethrow_exception(job.error);
+}// Run
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Worker thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Worker(int index)
+{
+    for (;;)
+    {
+        STask task;
+        if (Pop(index, task))
+        {
+            Execute(task);
+            continue;
+        }// if
+
+        unique_lock<mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this]() { return m_bStopping || m_queued > 0; });
+        if (m_bStopping && m_queued == 0)
+            return;
+    }// for
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take a task, from the back of the worker's own queue if it has one,
+//  otherwise from the front of any queue.  index is -1 for helping callers.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CThreadPool::Pop(int index, STask& task)
+{
+    if (m_queued == 0)
+        return false;
+
+    if (index >= 0)
+    {
+        SQueue& queue = *m_queues[index];
+        lock_guard<mutex> lock(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            --m_queued;
+            return true;
+        }// if
+    }// if
+
+    int queues = (int)m_queues.size();
+    for (int i = 1; i <= queues; ++i)
+    {
+        SQueue& queue = *m_queues[(Max(index, 0) + i) % queues];
+        lock_guard<mutex> lock(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            --m_queued;
+            return true;
+        }// if
+    }// for
+
+    return false;
+}// Pop
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run one chunk and signal its job when it was the last one.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Execute(const STask& task)
+{
+    SJob& job = *task.pJob;
+    {
+        CProfiler::CSpan span("parallel-for");
+        try
+        {
+            RunChunk(*job.pBody, task.begin, task.end, job.pProgress);
+        }// try
+        catch (...)
+        {
+            lock_guard<mutex> lock(job.errorLock);
+            if (!job.error)
+                job.error = current_exception();
+        }// catch
+    }
+
+    if (--job.remaining == 0)
+    {
+        lock_guard<mutex> lock(m_doneMutex);
+        m_done.notify_all();
+    }// if
+}// Execute
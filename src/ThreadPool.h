@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.h
+//
+//      Process wide work-stealing thread pool shared by the image operations.
+//  ParallelFor splits an index range (usually image rows) into chunks of a
+//  given grain; each worker takes chunks from its own queue and steals from
+//  the others when it runs dry, and the calling thread helps until its range
+//  is done, so nested and concurrent calls cannot deadlock.
+//
+//  The pool size comes from SetThreadCount (the -threads switch), else the
+//  IMAGEEDITING_THREADS environment variable, else the number of hardware
+//  threads.  The count includes the calling thread; a count of one runs
+//  everything inline.
+//
+//  A thread can attach an SProgress to the work it starts.  ParallelFor then
+//  counts the indices it is given and finishes, and stops starting chunks
+//  once the progress is cancelled, also for calls nested in its chunks.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CThreadPool
+{
+    // types
+    public:
+        struct SProgress
+        {
+            SProgress() : done(0), total(0), bCancelled(false) {}
+
+            std::atomic<long long>  done;           // indices finished
+            std::atomic<long long>  total;          // indices handed to ParallelFor
+            std::atomic<bool>       bCancelled;     // skip chunks not yet started
+        };// SProgress
+
+    // methods
+    public:
+        static CThreadPool& Instance();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Set the number of threads, 0 to use the default.  May be called at
+        //  any time no parallel work is running.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void SetThreadCount(int threads);
+        static int ThreadCount();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Call body(chunkBegin, chunkEnd) over [begin, end) in chunks of grain
+        //  indices and return when all are done.  Chunks may run in any order on
+        //  any thread.  The first exception thrown by body is rethrown here.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void ParallelFor(int begin, int end, int grain, const std::function<void (int, int)>& body);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Attach a progress to the ParallelFor calls made by this thread, NULL
+        //  to detach.  The progress must outlive those calls.  A cancelled call
+        //  returns early, leaving whatever its body hadn't done yet undone.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void SetProgress(SProgress* pProgress);
+        static SProgress* Progress();
+        static bool IsCancelled();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Compute map(chunkBegin, chunkEnd) for every chunk of grain indices in
+        //  parallel, then fold the results in index order with combine starting
+        //  from identity.  The chunking does not depend on the thread count, so
+        //  the result is the same for any number of threads.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        template<class Type, class Map, class Combine>
+        static Type ParallelReduce(int begin, int end, int grain, Type identity, Map map, Combine combine);
+
+    private:
+        struct SJob;
+
+        struct STask
+        {
+            SJob*   pJob;
+            int     begin;
+            int     end;
+        };
+
+        struct SQueue
+        {
+            std::mutex          lock;
+            std::deque<STask>   tasks;
+        };
+
+        CThreadPool();
+        ~CThreadPool();
+
+        void Start(int threads);
+        void Stop();
+        void Run(int begin, int end, int grain, const std::function<void (int, int)>& body);
+        void Worker(int index);
+        bool Pop(int index, STask& task);          // own queue first, then steal
+        void Execute(const STask& task);
+        static void RunChunk(const std::function<void (int, int)>& body, int begin, int end, SProgress* pProgress);
+
+    // members
+    private:
+        int                                     m_threads;          // including the calling thread
+        std::vector<std::thread>                m_workers;
+        std::vector<std::unique_ptr<SQueue> >   m_queues;           // one per worker
+        std::atomic<int>                        m_queued;           // tasks waiting in all queues
+        std::atomic<unsigned>                   m_nextQueue;        // round robin for new tasks
+        bool                                    m_bStopping;
+        std::mutex                              m_sleepMutex;
+        std::condition_variable                 m_wake;             // tasks queued or stopping
+        std::mutex                              m_doneMutex;
+        std::condition_variable                 m_done;             // some job finished
+};// CThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parallel reduction over fixed chunks.
+//
+///////////////////////////////////////////////////////////////////////////////
+template<class Type, class Map, class Combine>
+Type CThreadPool::ParallelReduce(int begin, int end, int grain, Type identity, Map map, Combine combine)
+{
+    if (end <= begin)
+        return identity;
+
+    grain = grain < 1 ? 1 : grain;
+    int chunks = (end - begin + grain - 1) / grain;
+    std::vector<Type> vPartials(chunks, identity);
+    ParallelFor(0, chunks, 1, [&](int first, int last)
+    {
+        for (int chunk = first; chunk < last; ++chunk)
+        {
+            int chunkBegin = begin + chunk * grain;
+            int chunkEnd = end - chunkBegin < grain ? end : chunkBegin + grain;
+            vPartials[chunk] = map(chunkBegin, chunkEnd);
+        }// for
+    });
+
+    Type result = identity;
+    for (int chunk = 0; chunk < chunks; ++chunk)
+        result = combine(result, vPartials[chunk]);
+    return result;
+}// ParallelReduce
+
+#endif // _THREAD_POOL_H_
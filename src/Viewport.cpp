@@ -0,0 +1,281 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Viewport.cpp
+//
+//      Implementation of CViewport methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Viewport.h"
+#include "TargaImage.h"
+#include "ThreadPool.h"
+#include <string.h>
+
+using namespace std;
+
+// constants
+const int           c_viewTile          = 64;                   // tile size in pixels for converting levels to RGB
+const int           c_maxZoom           = 5;                    // 32 screen pixels per image pixel
+const int           c_viewRowGrain      = 16;                   // screen rows per parallel chunk
+const unsigned char c_viewBackground[3] = { 64, 64, 64 };       // around the image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor and destructor.
+//
+///////////////////////////////////////////////////////////////////////////////
+CViewport::CViewport() : m_pImage(NULL), m_levels(0), m_zoom(0), m_scrollX(0), m_scrollY(0)
+{
+}// CViewport
+
+CViewport::~CViewport()
+{
+    Clear();
+}// ~CViewport
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free the pyramid and the converted tiles.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CViewport::Clear()
+{
+    for (size_t level = 1; level < m_vpPyramid.size(); level++)
+        delete m_vpPyramid[level];
+    for (size_t level = 0; level < m_vvpTiles.size(); level++)
+        for (size_t tile = 0; tile < m_vvpTiles[level].size(); tile++)
+            delete[] m_vvpTiles[level][tile];
+
+    m_vpPyramid.clear();
+    m_vvpTiles.clear();
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Show a new image, keeping zoom and scroll position.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CViewport::SetImage(const TargaImage* pImage, int levels)
+{
+    Clear();
+    m_pImage = pImage && pImage->data ? pImage : NULL;
+    m_levels = Max(levels, 0);
+    m_zoom = Max(m_zoom, MinZoom());
+}// SetImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The shown image halved index times, made on first use along with the
+//  levels above it.
+//
+///////////////////////////////////////////////////////////////////////////////
+const TargaImage* CViewport::Level(int index)
+{
+    while ((int)m_vpPyramid.size() <= index)
+    {
+        int level = (int)m_vpPyramid.size();
+        TargaImage* pHalf = NULL;
+        if (level > 0)
+        {
+            pHalf = new TargaImage(*Level(level - 1));
+            pHalf->Half_Size();
+        }// if
+
+        const TargaImage* pLevel = pHalf ? pHalf : m_pImage;
+        int tiles = ((pLevel->width + c_viewTile - 1) / c_viewTile) * ((pLevel->height + c_viewTile - 1) / c_viewTile);
+        m_vpPyramid.push_back(pHalf);
+        m_vvpTiles.push_back(vector<unsigned char*>(tiles, (unsigned char*)NULL));
+    }// while
+
+    return index > 0 ? m_vpPyramid[index] : m_pImage;
+}// Level
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Zoom limit, the zoom at which the last level that can be halved is
+//  shown 1:1.
+//
+///////////////////////////////////////////////////////////////////////////////
+int CViewport::MinZoom()
+{
+    if (!m_pImage)
+        return 0;
+
+    int halvings = 0;
+    while ((m_pImage->width >> (halvings + 1)) && (m_pImage->height >> (halvings + 1)))
+        halvings++;
+    return Min(-(m_levels + halvings), 0);
+}// MinZoom
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Size of the image at the current zoom, in screen pixels.  The level
+//  sizes follow Half_Size, which drops odd rows and columns.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CViewport::ZoomedSize(int& width, int& height)
+{
+    if (!m_pImage)
+    {
+        width = height = 0;
+        return;
+    }// if
+
+    int source = Max(-m_zoom, m_levels);
+    int magnify = source + m_zoom;
+    width = (m_pImage->width >> (source - m_levels)) << magnify;
+    height = (m_pImage->height >> (source - m_levels)) << magnify;
+}// ZoomedSize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Zoom and scroll.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CViewport::Zoom(int steps, int x, int y)
+{
+    int zoom = Min(Max(m_zoom + steps, MinZoom()), c_maxZoom);
+    int change = zoom - m_zoom;
+    if (!change)
+        return false;
+
+    int anchorX = m_scrollX + x;
+    int anchorY = m_scrollY + y;
+    if (change > 0)
+    {
+        anchorX *= 1 << change;
+        anchorY *= 1 << change;
+    }// if
+    else
+    {
+        anchorX >>= -change;
+        anchorY >>= -change;
+    }// else
+
+    m_zoom = zoom;
+    m_scrollX = anchorX - x;
+    m_scrollY = anchorY - y;
+    return true;
+}// Zoom
+
+void CViewport::Scroll(int dx, int dy)
+{
+    m_scrollX -= dx;
+    m_scrollY -= dy;
+}// Scroll
+
+void CViewport::Fit(int screenWidth, int screenHeight)
+{
+    m_zoom = 0;
+    int width, height;
+    ZoomedSize(width, height);
+    while (m_zoom > MinZoom() && (width > screenWidth || height > screenHeight))
+    {
+        m_zoom--;
+        ZoomedSize(width, height);
+    }// while
+
+    m_scrollX = (width - screenWidth) / 2;
+    m_scrollY = (height - screenHeight) / 2;
+}// Fit
+
+void CViewport::ActualSize(int x, int y)
+{
+    Zoom(-m_zoom, x, y);
+}// ActualSize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Draw the view.  Tiles of the level in use that come into sight are
+//  converted in parallel first, then screen rows are filled in parallel from
+//  them, repeating pixels when zoomed in.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CViewport::Render(unsigned char* rgb, int screenWidth, int screenHeight)
+{
+    int width, height;
+    ZoomedSize(width, height);
+    if (!m_pImage || width <= 0 || height <= 0)
+    {
+        for (int pixel = 0; pixel < screenWidth * screenHeight; pixel++)
+            memcpy(rgb + pixel * 3, c_viewBackground, 3);
+        return;
+    }// if
+
+    // keep the screen covered, or the image centered
+    m_scrollX = width <= screenWidth ? (width - screenWidth) / 2 : Min(Max(m_scrollX, 0), width - screenWidth);
+    m_scrollY = height <= screenHeight ? (height - screenHeight) / 2 : Min(Max(m_scrollY, 0), height - screenHeight);
+
+    int source = Max(-m_zoom, m_levels);
+    int index = source - m_levels;
+    int magnify = source + m_zoom;
+    const TargaImage* pLevel = Level(index);
+    vector<unsigned char*>& vpTiles = m_vvpTiles[index];
+    int tilesX = (pLevel->width + c_viewTile - 1) / c_viewTile;
+
+    // visible screen rectangle, and the tiles under it
+    int firstX = Max(0, -m_scrollX), lastX = Min(screenWidth, width - m_scrollX);
+    int firstY = Max(0, -m_scrollY), lastY = Min(screenHeight, height - m_scrollY);
+    vector<int> vMissing;
+    if (firstX < lastX && firstY < lastY)
+        for (int ty = ((m_scrollY + firstY) >> magnify) / c_viewTile; ty <= ((m_scrollY + lastY - 1) >> magnify) / c_viewTile; ty++)
+            for (int tx = ((m_scrollX + firstX) >> magnify) / c_viewTile; tx <= ((m_scrollX + lastX - 1) >> magnify) / c_viewTile; tx++)
+                if (!vpTiles[ty * tilesX + tx])
+                    vMissing.push_back(ty * tilesX + tx);
+
+    CThreadPool::ParallelFor(0, (int)vMissing.size(), 1, [&](int first, int last)
+    {
+        for (int missing = first; missing < last; missing++)
+        {
+            int tx = vMissing[missing] % tilesX;
+            int ty = vMissing[missing] / tilesX;
+            int tileWidth = Min(c_viewTile, pLevel->width - tx * c_viewTile);
+            int tileHeight = Min(c_viewTile, pLevel->height - ty * c_viewTile);
+            unsigned char* pTile = new unsigned char[tileWidth * tileHeight * 3];
+            const_cast<TargaImage*>(pLevel)->To_RGB(tx * c_viewTile, ty * c_viewTile, tileWidth, tileHeight, pTile);
+            vpTiles[vMissing[missing]] = pTile;
+        }// for
+    });
+
+    CThreadPool::ParallelFor(0, screenHeight, c_viewRowGrain, [&](int first, int last)
+    {
+        for (int sy = first; sy < last; sy++)
+        {
+            unsigned char* pOut = rgb + sy * screenWidth * 3;
+            bool bRowVisible = sy >= firstY && sy < lastY;
+            for (int sx = 0; sx < screenWidth; sx++)
+                if (!bRowVisible || sx < firstX || sx >= lastX)
+                    memcpy(pOut + sx * 3, c_viewBackground, 3);
+            if (!bRowVisible)
+                continue;
+
+            int y = (m_scrollY + sy) >> magnify;
+            int ty = y / c_viewTile;
+            for (int sx = firstX; sx < lastX; )
+            {
+                int tx = ((m_scrollX + sx) >> magnify) / c_viewTile;
+                int tileWidth = Min(c_viewTile, pLevel->width - tx * c_viewTile);
+                const unsigned char* pRow = vpTiles[ty * tilesX + tx] + (y - ty * c_viewTile) * tileWidth * 3;
+                int tileX = tx * c_viewTile;
+                int spanEnd = Min(lastX, ((tileX + tileWidth) << magnify) - m_scrollX);
+                if (!magnify)
+                {
+                    memcpy(pOut + sx * 3, pRow + (m_scrollX + sx - tileX) * 3, (spanEnd - sx) * 3);
+                    sx = spanEnd;
+                }// if
+                else
+                    for (; sx < spanEnd; sx++)
+                        memcpy(pOut + sx * 3, pRow + (((m_scrollX + sx) >> magnify) - tileX) * 3, 3);
+            }// for
+        }// for
+    });
+}// Render
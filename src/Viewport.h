@@ -0,0 +1,80 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Viewport.h
+//
+//      A zoomable, scrollable view of an image, rendered into a screen sized
+//  RGB buffer.  Zoom goes in powers of two.  Zoomed out views read the level
+//  of a mip pyramid (Half_Size of the level before) that matches the zoom, and
+//  zoomed in views repeat pixels, so rendering costs screen pixels whatever
+//  the image size.  Levels and their RGB conversion are made lazily, in tiles
+//  of c_viewTile pixels, only where they are seen.
+//
+//  The shown image may itself be a proxy some levels below the real image,
+//  it then stands in for those pyramid levels.  Positions are kept in
+//  pixels of the zoomed image, with (0, 0) at the image's top left corner.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _VIEWPORT_H_
+#define _VIEWPORT_H_
+
+#include <vector>
+
+class TargaImage;
+
+class CViewport
+{
+    // methods
+    public:
+        CViewport();
+        ~CViewport();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Show the given image, levels halvings below the real image, or none.
+        //  Drops the pyramid and converted tiles; call it again whenever the
+        //  image's pixels change.  The image must outlive its use here.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void SetImage(const TargaImage* pImage, int levels);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Zoom in (steps > 0) or out keeping the image point under the screen
+        //  position (x, y) in place, within the zoom range.  Return whether the
+        //  zoom changed.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        bool Zoom(int steps, int x, int y);
+
+        void Scroll(int dx, int dy);                        // move the image by screen pixels
+        void Fit(int screenWidth, int screenHeight);        // largest zoom up to 1:1 showing it all, centered
+        void ActualSize(int x, int y);                      // 1:1 around the screen position
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Draw the view into rgb, screenWidth x screenHeight pixels.  The
+        //  scroll position is first clamped so the image covers the screen, or is
+        //  centered where it is smaller.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Render(unsigned char* rgb, int screenWidth, int screenHeight);
+
+    private:
+        void Clear();
+        const TargaImage* Level(int index);                 // the shown image halved index times
+        void ZoomedSize(int& width, int& height);
+        int MinZoom();
+
+    // members
+    private:
+        const TargaImage*                           m_pImage;
+        int                                         m_levels;           // halvings from the real image to m_pImage
+        int                                         m_zoom;             // screen pixels per real pixel is 2^m_zoom
+        int                                         m_scrollX;          // zoomed image position at the screen's top left
+        int                                         m_scrollY;
+        std::vector<TargaImage*>                    m_vpPyramid;        // [0] unused, m_pImage is level 0
+        std::vector<std::vector<unsigned char*> >   m_vvpTiles;         // RGB tiles of each level, NULL until seen
+};// CViewport
+
+#endif // _VIEWPORT_H_
@@ -3,9 +3,10 @@
 */
 
 #include <stdio.h>
-#include <malloc.h>
+#include <stdlib.h>
 
 #include "libtarga.h"
+#include "Premultiply.h"
 
 
 
@@ -53,7 +54,23 @@
 #define TGA_ERR_BAD_DIMENSIONS          (11)
 
 
-static uint32 TargaError;
+/* the last error is kept per thread, loads and saves may run on several at once */
+#ifdef _MSC_VER
+#define TGA_THREAD_LOCAL __declspec( thread )
+#else
+#define TGA_THREAD_LOCAL __thread
+#endif
+
+static TGA_THREAD_LOCAL uint32 TargaError;
+
+
+/* counts the buffers allocated here towards the profiler's bytes allocated, see Profiler.h */
+void profiler_count_allocation( size_t bytes );
+
+static void * tga_malloc( size_t bytes ) {
+    profiler_count_allocation( bytes );
+    return( malloc( bytes ) );
+}
 
 
 static int16 ttohs( int16 val );
@@ -69,7 +86,7 @@ static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number,
                                    uint32 w, uint32 h, uint32 pixel, uint32 format );
 
 
-/* returns the last error encountered */
+/* returns the last error encountered on the calling thread */
 int tga_get_last_error() {
     return( TargaError );
 }
@@ -133,10 +150,10 @@ void * tga_create( int width, int height, unsigned int format ) {
     switch( format ) {
         
     case TGA_TRUECOLOR_32:
-        return( (void *)malloc( width * height * 4 ) );
+        return( (void *)tga_malloc( width * height * 4 ) );
         
     case TGA_TRUECOLOR_24:
-        return( (void *)malloc( width * height * 3 ) );
+        return( (void *)tga_malloc( width * height * 3 ) );
         
     default:
         TargaError = TGA_ERR_BAD_FORMAT;
@@ -221,7 +238,7 @@ void * tga_load( const char * filename,
 
 
     /* allocate memory for the header */
-    tga_hdr = (ubyte *)malloc( HDR_LENGTH );
+    tga_hdr = (ubyte *)tga_malloc( HDR_LENGTH );
 
     /* read the header in. */
     if( fread( (void *)tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
@@ -321,7 +338,7 @@ void * tga_load( const char * filename,
         }
         
         cmap_bytes = cmap_bytes_entry * cmap_length;
-        colormap = (ubyte *)malloc( cmap_bytes );
+        colormap = (ubyte *)tga_malloc( cmap_bytes );
         
         
         for( i = 0; i < cmap_length; i++ ) {
@@ -370,7 +387,7 @@ void * tga_load( const char * filename,
     /* compute how many bytes of storage we need for the image */
     bytes_total = img_spec_width * img_spec_height * format;
 
-    image_data = (ubyte *)malloc( bytes_total );
+    image_data = (ubyte *)tga_malloc( bytes_total );
 
     img_dat_len = img_spec_width * img_spec_height * bytes_per_pix;
 
@@ -482,7 +499,7 @@ int tga_write_raw( const char * file, int width, int height, unsigned char * dat
 
     uint32 size = width * height;
 
-    float red, green, blue, alpha;
+    ubyte straight[4];
 
     char id[] = "written with libtarga";
     ubyte idlen = 21;
@@ -571,26 +588,10 @@ int tga_write_raw( const char * file, int width, int height, unsigned char * dat
 
             /* need to un-premultiply alpha.. */
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
+            alpha_unpremultiply_row( dat + i * 4, straight, 1 );
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
-
-            /* clamp to 1.0f */
-
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
-
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
+            pixbuf = straight[2] + (straight[1] << 8) + 
+                (straight[0] << 16) + (straight[3] << 24);
                 
             pixbuf = htotl( pixbuf );
            
@@ -629,12 +630,12 @@ int tga_write_rle( const char * file, int width, int height, unsigned char * dat
 
     ubyte repcount;
 
-    float red, green, blue, alpha;
+    ubyte straight[4];
 
     int idx, row, column;
 
     // have to buffer a whole line for raw packets.
-    unsigned char * rawbuf = (unsigned char *)malloc( width * format );  
+    unsigned char * rawbuf = (unsigned char *)tga_malloc( width * format );  
 
     char id[] = "written with libtarga";
     ubyte idlen = 21;
@@ -724,26 +725,10 @@ int tga_write_rle( const char * file, int width, int height, unsigned char * dat
 
             /* need to un-premultiply alpha.. */
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
-
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
-
-            /* clamp to 1.0f */
-
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+            alpha_unpremultiply_row( dat + i * 4, straight, 1 );
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
+            pixbuf = straight[2] + (straight[1] << 8) + 
+                (straight[0] << 16) + (straight[3] << 24);
                 
             pixbuf = htotl( pixbuf );
             break;
@@ -1073,6 +1058,7 @@ static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, u
     // this thing will also premultiply alpha, on a pixel by pixel basis.
 
     ubyte r, g, b, a;
+    const unsigned char * premultiply;
 
     switch( bpp_in ) {
         
@@ -1120,9 +1106,10 @@ is_15_bit_in_disguise:
     a = (pixel & 0xFF000000) >> 24;
     
     // not premultiplied alpha -- multiply.
-    r = (ubyte)(((float)r / 255.0f) * ((float)a / 255.0f) * 255.0f);
-    g = (ubyte)(((float)g / 255.0f) * ((float)a / 255.0f) * 255.0f);
-    b = (ubyte)(((float)b / 255.0f) * ((float)a / 255.0f) * 255.0f);
+    premultiply = alpha_premultiply_table() + a * 256;
+    r = premultiply[r];
+    g = premultiply[g];
+    b = premultiply[b];
 
     pixel = r + (g << 8) + (b << 16) + (a << 24);
 
@@ -72,7 +72,7 @@ extern "C" {
 
 
 /* Error handling routines */
-int             tga_get_last_error();
+int             tga_get_last_error();                   /* per thread */
 const char *    tga_error_string( int error_code );
 
 